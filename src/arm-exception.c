@@ -4,6 +4,7 @@
 #include "rpi-interrupts.h"
 //#include "tube-defs.h"
 #include "startup.h"
+#include "logging.h"
 
 // From here: https://www.raspberrypi.org/forums/viewtopic.php?f=72&t=53862
 void reboot_now(void)
@@ -66,6 +67,8 @@ void dump_info(unsigned int *context, int offset, char *type) {
    unsigned int flags;
    int i, j;
 
+   // Write out any queued log messages first, as they may say what went wrong
+   log_flush();
    // Make sure we avoid unaligned accesses
    context = (unsigned int *)(((unsigned int) context) & ~3);
    // context point into the exception stack, at flags, followed by registers 0 .. 13
@@ -0,0 +1,47 @@
+#include <stddef.h>
+#include "bootprof.h"
+#include "logging.h"
+#include "rpi-systimer.h"
+
+// =============================================================
+// Local variables
+// =============================================================
+
+static bootprof_phase_t phases[BOOTPROF_MAX_PHASES];
+
+static int num_phases;
+
+static int done;
+
+// =============================================================
+// Public methods
+// =============================================================
+
+void bootprof_phase(const char *name) {
+   if (done || num_phases == BOOTPROF_MAX_PHASES) {
+      return;
+   }
+   phases[num_phases].name = name;
+   phases[num_phases].time = RPI_GetSystemTimer();
+   num_phases++;
+}
+
+void bootprof_report() {
+   uint32_t last = 0;
+   if (done) {
+      return;
+   }
+   done = 1;
+   for (int i = 0; i < num_phases; i++) {
+      log_info("Boot: %8u us (+%7u us) %s", (unsigned int) phases[i].time, (unsigned int) (phases[i].time - last), phases[i].name);
+      last = phases[i].time;
+   }
+}
+
+int bootprof_num_phases() {
+   return num_phases;
+}
+
+const bootprof_phase_t *bootprof_get_phase(int i) {
+   return (i >= 0 && i < num_phases) ? &phases[i] : NULL;
+}
@@ -0,0 +1,30 @@
+// bootprof.h
+
+#ifndef BOOTPROF_H
+#define BOOTPROF_H
+
+#include <stdint.h>
+
+// Boot time profiler
+//
+// Each phase of the boot is timestamped with the system timer, which starts
+// when the Pi is powered on, so the times include the GPU firmware boot.
+
+#define BOOTPROF_MAX_PHASES 16
+
+typedef struct {
+   const char *name;
+   uint32_t time;      // system timer at the end of the phase, in microseconds
+} bootprof_phase_t;
+
+// Record the end of a boot phase (ignored once bootprof_report() has been called)
+extern void bootprof_phase(const char *name);
+
+// Log the boot phases, and stop recording
+extern void bootprof_report();
+
+extern int bootprof_num_phases();
+
+extern const bootprof_phase_t *bootprof_get_phase(int i);
+
+#endif
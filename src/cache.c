@@ -22,6 +22,12 @@ const static int aa = 1;
 const static int bb = 1;
 const static int shareable = 1;
 
+#if defined(RPI2) || defined (RPI3)
+#define L1_DATA_CACHE_LINE_LENGTH  64
+#else
+#define L1_DATA_CACHE_LINE_LENGTH  32
+#endif
+
 #if defined(RPI2) || defined (RPI3)
 
 #define SETWAY_LEVEL_SHIFT          1
@@ -49,12 +55,11 @@ const static int shareable = 1;
 // The origin of this function is:
 // https://github.com/rsta2/uspi/blob/master/env/lib/synchronize.c
 
-void InvalidateDataCache (void)
+static void InvalidateL1DataCache (void)
 {
    unsigned nSet;
    unsigned nWay;
    uint32_t nSetWayLevel;
-   // invalidate L1 data cache
    for (nSet = 0; nSet < L1_DATA_CACHE_SETS; nSet++) {
       for (nWay = 0; nWay < L1_DATA_CACHE_WAYS; nWay++) {
          nSetWayLevel = nWay << L1_SETWAY_WAY_SHIFT
@@ -63,6 +68,15 @@ void InvalidateDataCache (void)
          asm volatile ("mcr p15, 0, %0, c7, c6,  2" : : "r" (nSetWayLevel) : "memory");   // DCISW
       }
    }
+}
+
+void InvalidateDataCache (void)
+{
+   unsigned nSet;
+   unsigned nWay;
+   uint32_t nSetWayLevel;
+   // invalidate L1 data cache
+   InvalidateL1DataCache();
 
    // invalidate L2 unified cache
    for (nSet = 0; nSet < L2_CACHE_SETS; nSet++) {
@@ -130,6 +144,54 @@ void map_4k_page(int logical, int physical) {
 #endif
 }
 
+// Write back any dirty cache lines in [start, start + size) to memory
+void clean_data_cache_range(void *start, unsigned int size) {
+   unsigned int mva = ((unsigned int) start) & ~(L1_DATA_CACHE_LINE_LENGTH - 1);
+   unsigned int end = ((unsigned int) start) + size;
+#if defined(RPI2) || defined(RPI3)
+   // DCCMVAC cleans to the point of coherency, so through L2 as well
+   for (; mva < end; mva += L1_DATA_CACHE_LINE_LENGTH) {
+      asm volatile ("mcr p15, 0, %0, c7, c10, 1" : : "r" (mva) : "memory");
+   }
+   asm volatile ("dsb" ::: "memory");
+#else
+   // ARM1176 clean data cache range (end address is inclusive)
+   if (mva < end) {
+      asm volatile ("mcrr p15, 0, %0, %1, c12" : : "r" (end - 1), "r" (mva) : "memory");
+   }
+   // Data synchronization barrier
+   asm volatile ("mcr p15, 0, %0, c7, c10, 4" : : "r" (0) : "memory");
+#endif
+}
+
+// Change the 1MB sections covering [start, start + size) to be L2 cached only
+// (as for L2_CACHED_MEM_BASE), or back to uncached
+void map_l2_cached(void *start, unsigned int size, int cached) {
+   unsigned base;
+   unsigned first = ((unsigned) start) >> 20;
+   unsigned last = (((unsigned) start) + size - 1) >> 20;
+   if (!cached) {
+      // Anything still in the cache must reach memory before it is bypassed
+      clean_data_cache_range(start, size);
+   }
+   for (base = first; base <= last && base < uncached_threshold; base++) {
+      if (cached) {
+         PageTable[base] = base << 20 | 0x04C02 | (shareable << 16) | (bb << 12);
+      } else {
+         PageTable[base] = base << 20 | 0x01C02;
+      }
+   }
+#if defined(RPI2) || defined(RPI3)
+   // Invalidate the TLBs of all the cores (TLBIALLIS), as core 1 also accesses the frame buffer
+   asm volatile ("dsb" ::: "memory");
+   asm volatile ("mcr p15, 0, %0, c8, c3, 0" : : "r" (0) : "memory");
+   asm volatile ("dsb\n\tisb" ::: "memory");
+#else
+   asm volatile ("mcr p15, 0, %0, c7, c10, 4" : : "r" (0) : "memory");
+   _invalidate_dtlb();
+#endif
+}
+
 void enable_MMU_and_IDCaches(void)
 {
 
@@ -298,3 +360,42 @@ void enable_MMU_and_IDCaches(void)
    asm volatile ("mrc p15,0,%0,c0,c0,1" : "=r" (ctype));
    //log_debug("ctype   = %08x", ctype);
 }
+
+#if defined(RPI2) || defined(RPI3)
+// Enable the MMU and caches on a secondary core, using the page table already set up by core 0
+//
+// Only this core's L1 data cache is invalidated, as the L2 is shared and may hold dirty data
+void enable_MMU_secondary(void)
+{
+#if !defined(RPI3)
+   // RPI2: bit 6 of auxctrl is set SMP bit, otherwise this core's cache is not coherent
+   unsigned auxctrl;
+   asm volatile ("mrc p15, 0, %0, c1, c0,  1" : "=r" (auxctrl));
+   auxctrl |= 1 << 6;
+   asm volatile ("mcr p15, 0, %0, c1, c0,  1" :: "r" (auxctrl));
+#endif
+
+   // set domain 0 to client
+   asm volatile ("mcr p15, 0, %0, c3, c0, 0" :: "r" (1));
+
+   // always use TTBR0
+   asm volatile ("mcr p15, 0, %0, c2, c0, 2" :: "r" (0));
+
+   // set TTBR0, with the same page table walk attributes as core 0
+   int attr = ((aa & 1) << 6) | (bb << 3) | (shareable << 1) | ((aa & 2) >> 1);
+   asm volatile ("mcr p15, 0, %0, c2, c0, 0" :: "r" (attr | (unsigned) &PageTable));
+
+   asm volatile ("isb" ::: "memory");
+   InvalidateL1DataCache();
+   asm volatile ("mcr p15, 0, %0, c8, c7, 0" :: "r" (0) : "memory");   // TLBIALL
+   asm volatile ("dsb\n\tisb" ::: "memory");
+
+   // enable MMU, L1 cache and instruction cache, L2 cache, write buffer,
+   //   branch prediction and extended page table on
+   unsigned sctrl;
+   asm volatile ("mrc p15,0,%0,c1,c0,0" : "=r" (sctrl));
+   sctrl |= 0x00001805;
+   asm volatile ("mcr p15,0,%0,c1,c0,0" :: "r" (sctrl) : "memory");
+   asm volatile ("isb" ::: "memory");
+}
+#endif
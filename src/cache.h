@@ -24,6 +24,14 @@ void map_4k_page(int logical, int physical);
 
 void enable_MMU_and_IDCaches(void);
 
+void clean_data_cache_range(void *start, unsigned int size);
+
+void map_l2_cached(void *start, unsigned int size, int cached);
+
+#if defined(RPI2) || defined(RPI3)
+void enable_MMU_secondary(void);
+#endif
+
 #endif
 
 #endif
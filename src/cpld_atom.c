@@ -5,8 +5,10 @@
 #include <string.h>
 #include "defs.h"
 #include "cpld.h"
+#include "format.h"
 #include "osd.h"
 #include "logging.h"
+#include "telemetry.h"
 #include "rgb_to_fb.h"
 #include "rpi-gpio.h"
 
@@ -83,14 +85,14 @@ static void write_config(config_t *config) {
 
 static void osd_sp(config_t *config, int line, int metric) {
    // Line ------
-   sprintf(message, "Offset: %d", config->sp_offset);
+   format_sprintf(message, "Offset: %d", config->sp_offset);
    osd_set(line, 0, message);
    line++;
    // Line ------
    if (metric < 0) {
-      sprintf(message, "Errors: unknown");
+      format_sprintf(message, "Errors: unknown");
    } else {
-      sprintf(message, "Errors: %d", metric);
+      format_sprintf(message, "Errors: %d", metric);
    }
    osd_set(line, 0, message);
 }
@@ -130,16 +132,13 @@ static void cpld_calibrate(capture_info_t *capinfo, int elk) {
 
    // Measure the error metrics at all possible offset values
    min_metric = INT_MAX;
-   printf("INFO:                      ");
-   for (int i = 0; i < NUM_OFFSETS; i++) {
-      printf("%7c", 'A' + i);
-   }
-   printf("   total\r\n");
+   log_info("%21s%7c%7c%7c%7c%7c%7c   total", "", 'A', 'B', 'C', 'D', 'E', 'F');
    for (int value = 0; value < range; value++) {
       config->sp_offset = value;
       write_config(config);
       metric = diff_N_frames(capinfo, NUM_CAL_FRAMES, 0, elk);
-      log_info("INFO: value = %d: metric = ", metric);
+      telemetry_event(TM_CAL_METRIC, value, metric);
+      log_info("value = %d: metric = %d", value, metric);
       sum_metrics[value] = metric;
       osd_sp(config, 1, metric);
       if (metric < min_metric) {
@@ -172,6 +171,7 @@ static void cpld_calibrate(capture_info_t *capinfo, int elk) {
    osd_sp(config, 1, errors);
    log_sp(config);
    log_info("Calibration complete, errors = %d", errors);
+   telemetry_event(TM_CAL_RESULT, min_i, errors);
 }
 
 static void cpld_set_mode(capture_info_t *capinfo, int mode) {
@@ -223,12 +223,12 @@ static void cpld_show_cal_summary(int line) {
 static void cpld_show_cal_details(int line) {
    int range = (*sum_metrics < 0) ? 0 : RANGE;
    if (range == 0) {
-      sprintf(message, "No calibration data for this mode");
+      format_sprintf(message, "No calibration data for this mode");
       osd_set(line, 0, message);
    } else {
       int num = range >> 1;
       for (int value = 0; value < num; value++) {
-         sprintf(message, "Offset %d: %6d; Offset %2d: %6d", value, sum_metrics[value], value + num, sum_metrics[value + num]);
+         format_sprintf(message, "Offset %d: %6d; Offset %2d: %6d", value, sum_metrics[value], value + num, sum_metrics[value + num]);
          osd_set(line + value, 0, message);
       }
    }
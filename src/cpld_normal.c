@@ -5,9 +5,11 @@
 #include <string.h>
 #include "defs.h"
 #include "cpld.h"
+#include "format.h"
 #include "geometry.h"
 #include "osd.h"
 #include "logging.h"
+#include "telemetry.h"
 #include "rgb_to_fb.h"
 #include "rpi-gpio.h"
 
@@ -138,26 +140,26 @@ static void osd_sp(config_t *config, int line, int metric) {
    }
    line++;
    // Line ------
-   sprintf(message, "Offsets: %d %d %d %d %d %d",
+   format_sprintf(message, "Offsets: %d %d %d %d %d %d",
            config->sp_offset[0], config->sp_offset[1], config->sp_offset[2],
            config->sp_offset[3], config->sp_offset[4], config->sp_offset[5]);
    osd_set(line, 0, message);
    line++;
    // Line ------
-   sprintf(message, "   Half: %d", config->half_px_delay);
+   format_sprintf(message, "   Half: %d", config->half_px_delay);
    osd_set(line, 0, message);
    line++;
    // Line ------
    if (supports_delay) {
-      sprintf(message, "  Delay: %d", config->full_px_delay);
+      format_sprintf(message, "  Delay: %d", config->full_px_delay);
       osd_set(line, 0, message);
       line++;
    }
    // Line ------
    if (metric < 0) {
-      sprintf(message, " Errors: unknown");
+      format_sprintf(message, " Errors: unknown");
    } else {
-      sprintf(message, " Errors: %d", metric);
+      format_sprintf(message, " Errors: %d", metric);
    }
    osd_set(line, 0, message);
 }
@@ -250,11 +252,7 @@ static void cpld_calibrate(capture_info_t *capinfo, int elk) {
    min_metric = INT_MAX;
    config->half_px_delay = 0;
    config->full_px_delay = 0;
-   printf("INFO:                      ");
-   for (int i = 0; i < NUM_OFFSETS; i++) {
-      printf("%7c", 'A' + i);
-   }
-   printf("   total\r\n");
+   log_info("%21s%7c%7c%7c%7c%7c%7c   total", "", 'A', 'B', 'C', 'D', 'E', 'F');
    for (int value = 0; value < range; value++) {
       for (int i = 0; i < NUM_OFFSETS; i++) {
          config->sp_offset[i] = value;
@@ -262,13 +260,15 @@ static void cpld_calibrate(capture_info_t *capinfo, int elk) {
       write_config(config);
       by_sample_metrics = diff_N_frames_by_sample(capinfo, NUM_CAL_FRAMES, mode7, elk);
       metric = 0;
-      printf("INFO: value = %d: metrics = ", value);
       for (int i = 0; i < NUM_OFFSETS; i++) {
          (*raw_metrics)[value][i] = by_sample_metrics[i];
          metric += by_sample_metrics[i];
-         printf("%7d", by_sample_metrics[i]);
       }
-      printf("%8d\r\n", metric);
+      telemetry_event(TM_CAL_METRIC, value, metric);
+      log_info("value = %d: metrics = %7d%7d%7d%7d%7d%7d%8d", value,
+               by_sample_metrics[0], by_sample_metrics[1], by_sample_metrics[2],
+               by_sample_metrics[3], by_sample_metrics[4], by_sample_metrics[5],
+               metric);
       sum_metrics[value] = metric;
       osd_sp(config, 1, metric);
       if (metric < min_metric) {
@@ -357,6 +357,7 @@ static void cpld_calibrate(capture_info_t *capinfo, int elk) {
    osd_sp(config, 1, *errors);
    log_sp(config);
    log_info("Calibration complete, errors = %d", *errors);
+   telemetry_event(TM_CAL_RESULT, min_i, *errors);
 }
 
 static void update_param_range() {
@@ -391,7 +392,7 @@ static void cpld_set_mode(capture_info_t *capinfo, int mode) {
    if (capinfo) {
       if (!mode) {
          if (capinfo->bpp == 8) {
-            capinfo->capture_line = capture_line_default_8bpp;
+            capinfo->capture_line = capture_line_default_8bpp_ma;
          } else {
             if (capinfo->px_sampling == PS_DOUBLE) {
                capinfo->capture_line = capture_line_default_4bpp_double;
@@ -400,7 +401,7 @@ static void cpld_set_mode(capture_info_t *capinfo, int mode) {
             } else if (capinfo->px_sampling == PS_SUBSAMP_O) {
                capinfo->capture_line = capture_line_default_4bpp_subsample_odd;
             } else {
-               capinfo->capture_line = capture_line_default_4bpp;
+               capinfo->capture_line = capture_line_default_4bpp_ma;
             }
          }
       }
@@ -487,11 +488,11 @@ static void cpld_show_cal_details(int line) {
    int *sum_metrics = mode7 ? sum_metrics_mode7 : sum_metrics_default;
    int range = (*sum_metrics < 0) ? 0 : config->divider;
    if (range == 0) {
-      sprintf(message, "No calibration data for this mode");
+      format_sprintf(message, "No calibration data for this mode");
       osd_set(line, 0, message);
    } else {
       for (int value = 0; value < range; value++) {
-         sprintf(message, "Offset %d: Errors = %6d", value, sum_metrics[value]);
+         format_sprintf(message, "Offset %d: Errors = %6d", value, sum_metrics[value]);
          osd_set(line + value, 0, message);
       }
    }
@@ -501,14 +502,14 @@ static void cpld_show_cal_raw(int line) {
    int (*raw_metrics)[8][NUM_OFFSETS] = mode7 ? &raw_metrics_mode7 : &raw_metrics_default;
    int range = ((*raw_metrics)[0][0] < 0) ? 0 : config->divider;
    if (range == 0) {
-      sprintf(message, "No calibration data for this mode");
+      format_sprintf(message, "No calibration data for this mode");
       osd_set(line, 0, message);
    } else {
       for (int value = 0; value < range; value++) {
          char *mp = message;
-         mp += sprintf(mp, "%d:", value);
+         mp += format_sprintf(mp, "%d:", value);
          for (int i = 0; i < NUM_OFFSETS; i++) {
-            mp += sprintf(mp, "%6d", (*raw_metrics)[value][i]);
+            mp += format_sprintf(mp, "%6d", (*raw_metrics)[value][i]);
          }
          osd_set(line + value, 0, message);
       }
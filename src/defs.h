@@ -26,6 +26,22 @@
 // (it can be set to less that this on the OSD)
 #define NBUFFERS 4
 
+// Use the capture kernels that write the frame buffer four words at a time
+// (modes 0-6 only, when not deinterlacing), which also allows line doubling
+// on the multi core Pi
+#define BURST_CAPTURE
+
+// Size of the deinterlace comparison buffer, which is in cached ARM memory
+// and uses the frame buffer line layout (i.e. the same pitch)
+#define COMPARE_BUFFER_SIZE (600 * 800)
+
+// Motion bitmap used by the Mode 0..6 motion adaptive deinterlace, with one
+// bit per captured word. Each frame buffer line has two planes: the motion
+// in the last field, and in the field before that.
+#define MOTION_PLANE_BYTES  64
+#define MOTION_ROW_BYTES    (2 * MOTION_PLANE_BYTES)
+#define MOTION_BITMAP_SIZE  (600 * MOTION_ROW_BYTES)
+
 #define VSYNCINT 16
 
 // Control bits (maintained in r3)
@@ -60,8 +76,13 @@
 
 #define BIT_FIELD_TYPE1       0x00800000  // bit 23, indicates the field type of the previous field
 #define BIT_FIELD_TYPE1_VALID 0x01000000  // bit 24, indicates FIELD_TYPE1 is valid
+#define BIT_MAJORITY          0x02000000  // bit 25, indicates the temporal majority filter should be applied
+#define BIT_STATIC            0x04000000  // bit 26, indicates the field is identical to the one last flipped to
+
+                                          // bits 27-31 unused
 
-                                          // bits 25-31 unused
+// The most consecutive fields that are treated as static, before one is flipped to anyway
+#define STATIC_MAX_FIELDS 50
 // R0 return value bits
 #define RET_SW1               0x02
 #define RET_SW2               0x04
@@ -77,6 +98,8 @@
 // Define the pixel clock for sampling
 #define GPCLK_SOURCE               5      // PLLC (CORE_FREQ * 3)
 #define DEFAULT_GPCLK_DIVISOR     12      // 96MHz
+#define GPCLK_FRACTION_BITS       12      // DIVF is GP_CLK1_DIV[11:0]
+#define GPCLK_MASH                 1      // MASH mode used with a fractional divisor
 
 // Pi 2/3 Multicore options
 #if defined(RPI2) || defined(RPI3)
@@ -0,0 +1,362 @@
+#include <string.h>
+#include "format.h"
+
+#define FORMAT_MAX_FRACTION 9
+
+// Enough for a 64-bit octal number
+#define FORMAT_DIGITS       24
+
+static const unsigned long long powers_of_ten[FORMAT_MAX_FRACTION + 1] = {
+   1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL,
+   1000000ULL, 10000000ULL, 100000000ULL, 1000000000ULL
+};
+
+// =============================================================
+// Private methods
+// =============================================================
+
+typedef struct {
+   char *buf;
+   int size;
+   int len;
+} format_out_t;
+
+static void put_char(format_out_t *out, char c) {
+   if (out->len < out->size - 1) {
+      out->buf[out->len++] = c;
+   }
+}
+
+static void put_repeat(format_out_t *out, char c, int n) {
+   while (n-- > 0) {
+      put_char(out, c);
+   }
+}
+
+static int finish(format_out_t *out) {
+   if (out->size > 0) {
+      out->buf[out->len] = '\0';
+   }
+   return out->len;
+}
+
+// Write digits into the end of tmp, returning a pointer to the first digit
+static char *put_digits(char *end, unsigned long long value, int base, int upper) {
+   const char *digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+   char *p = end;
+   do {
+      *--p = digits[value % base];
+      value /= base;
+   } while (value);
+   return p;
+}
+
+// Output a number, with its sign/prefix, zero padding and width padding
+static void put_number(format_out_t *out, const format_spec_t *spec, const char *prefix,
+                       const char *digits, int ndigits, int nzeros) {
+   int nprefix = strlen(prefix);
+   int pad = spec->width - nprefix - nzeros - ndigits;
+   if (!(spec->flags & (FORMAT_LEFT | FORMAT_ZERO))) {
+      put_repeat(out, ' ', pad);
+   }
+   while (*prefix) {
+      put_char(out, *prefix++);
+   }
+   if ((spec->flags & (FORMAT_LEFT | FORMAT_ZERO)) == FORMAT_ZERO) {
+      put_repeat(out, '0', pad);
+   }
+   put_repeat(out, '0', nzeros);
+   while (ndigits--) {
+      put_char(out, *digits++);
+   }
+   if (spec->flags & FORMAT_LEFT) {
+      put_repeat(out, ' ', pad);
+   }
+}
+
+static const char *sign_prefix(const format_spec_t *spec, int negative) {
+   if (negative) {
+      return "-";
+   } else if (spec->flags & FORMAT_PLUS) {
+      return "+";
+   } else if (spec->flags & FORMAT_SPACE) {
+      return " ";
+   }
+   return "";
+}
+
+static void do_int(format_out_t *out, const format_spec_t *spec, unsigned long long value) {
+   char tmp[FORMAT_DIGITS];
+   char *end = tmp + sizeof(tmp);
+   char *p;
+   const char *prefix = "";
+   int negative = 0;
+   int base = 10;
+   int nzeros = 0;
+   int is_ll = format_is_long_long(spec);
+   format_spec_t s = *spec;
+
+   switch (s.conv) {
+   case 'c':
+      s.flags &= ~FORMAT_ZERO;
+      tmp[0] = (char) value;
+      put_number(out, &s, "", tmp, 1, 0);
+      return;
+   case 'd':
+   case 'i':
+      if (!is_ll) {
+         value = (long long) (int) value;
+      }
+      if ((long long) value < 0) {
+         negative = 1;
+         value = -value;
+      }
+      prefix = sign_prefix(&s, negative);
+      break;
+   case 'o':
+      base = 8;
+      break;
+   case 'p':
+      s.flags |= FORMAT_ALT;
+      s.conv = 'x';
+      // Fall through
+   case 'x':
+   case 'X':
+      base = 16;
+      break;
+   }
+   if (s.conv != 'd' && s.conv != 'i' && !is_ll) {
+      value = (unsigned int) value;
+   }
+   if (s.precision >= 0) {
+      s.flags &= ~FORMAT_ZERO;
+   }
+   if (s.precision == 0 && value == 0) {
+      p = end;
+   } else {
+      p = put_digits(end, value, base, s.conv == 'X');
+   }
+   if (s.precision > end - p) {
+      nzeros = s.precision - (end - p);
+   }
+   if (s.flags & FORMAT_ALT) {
+      if (base == 16 && value) {
+         prefix = (s.conv == 'X') ? "0X" : "0x";
+      } else if (base == 8 && nzeros == 0 && (p == end || *p != '0')) {
+         nzeros = 1;
+      }
+   }
+   put_number(out, &s, prefix, p, end - p, nzeros);
+}
+
+static void do_double(format_out_t *out, const format_spec_t *spec, double value) {
+   char tmp[FORMAT_DIGITS + FORMAT_MAX_FRACTION + 2];
+   char *end = tmp + sizeof(tmp);
+   char *p = end;
+   unsigned long long ipart;
+   unsigned long long fpart;
+   unsigned long long scale;
+   int negative = 0;
+   int trim = (spec->conv == 'g' || spec->conv == 'G');
+   int precision = spec->precision < 0 ? 6 : spec->precision;
+   int i;
+   format_spec_t s = *spec;
+
+   if (precision > FORMAT_MAX_FRACTION) {
+      precision = FORMAT_MAX_FRACTION;
+   }
+   if (value != value) {
+      s.flags &= ~FORMAT_ZERO;
+      put_number(out, &s, "", "nan", 3, 0);
+      return;
+   }
+   if (value < 0) {
+      negative = 1;
+      value = -value;
+   }
+   if (value >= 1.8e19) {
+      s.flags &= ~FORMAT_ZERO;
+      put_number(out, &s, sign_prefix(&s, negative), "inf", 3, 0);
+      return;
+   }
+   scale = powers_of_ten[precision];
+   ipart = (unsigned long long) value;
+   fpart = (unsigned long long) ((value - (double) ipart) * (double) scale + 0.5);
+   if (fpart >= scale) {
+      fpart -= scale;
+      ipart++;
+   }
+   // Fractional digits, least significant first
+   for (i = 0; i < precision; i++) {
+      *--p = '0' + fpart % 10;
+      fpart /= 10;
+   }
+   if (trim) {
+      char *q = end;
+      while (q > p && q[-1] == '0') {
+         q--;
+      }
+      memmove(p + (end - q), p, q - p);
+      p += end - q;
+   }
+   if (p != end || (s.flags & FORMAT_ALT)) {
+      *--p = '.';
+   }
+   p = put_digits(p, ipart, 10, 0);
+   put_number(out, &s, sign_prefix(&s, negative), p, end - p, 0);
+}
+
+static void do_string(format_out_t *out, const format_spec_t *spec, const char *s) {
+   format_spec_t sp = *spec;
+   int len;
+   if (!s) {
+      s = "(null)";
+   }
+   len = strlen(s);
+   if (sp.precision >= 0 && len > sp.precision) {
+      len = sp.precision;
+   }
+   sp.flags &= ~FORMAT_ZERO;
+   put_number(out, &sp, "", s, len, 0);
+}
+
+// =============================================================
+// Public methods
+// =============================================================
+
+const char *format_parse(const char *p, format_spec_t *spec) {
+   spec->flags = 0;
+   spec->width = -1;
+   spec->precision = -1;
+   spec->longs = 0;
+   for (;; p++) {
+      switch (*p) {
+      case '-': spec->flags |= FORMAT_LEFT;  continue;
+      case '+': spec->flags |= FORMAT_PLUS;  continue;
+      case ' ': spec->flags |= FORMAT_SPACE; continue;
+      case '#': spec->flags |= FORMAT_ALT;   continue;
+      case '0': spec->flags |= FORMAT_ZERO;  continue;
+      }
+      break;
+   }
+   if (*p == '*') {
+      spec->width = FORMAT_STAR;
+      p++;
+   } else {
+      while (*p >= '0' && *p <= '9') {
+         spec->width = (spec->width < 0 ? 0 : spec->width * 10) + (*p++ - '0');
+      }
+   }
+   if (*p == '.') {
+      p++;
+      spec->precision = 0;
+      if (*p == '*') {
+         spec->precision = FORMAT_STAR;
+         p++;
+      } else {
+         while (*p >= '0' && *p <= '9') {
+            spec->precision = spec->precision * 10 + (*p++ - '0');
+         }
+      }
+   }
+   while (*p && strchr("hlLqjzt", *p)) {
+      if (*p == 'l') {
+         spec->longs++;
+      } else if (*p == 'L' || *p == 'q' || *p == 'j') {
+         spec->longs = 2;
+      }
+      p++;
+   }
+   spec->conv = *p;
+   return p;
+}
+
+int format_is_long_long(const format_spec_t *spec) {
+   if (spec->conv == 'p') {
+      return sizeof(void *) > sizeof(int);
+   }
+   return spec->longs >= 2 || (spec->longs == 1 && sizeof(long) > sizeof(int));
+}
+
+int format_int(char *buf, int size, const format_spec_t *spec, unsigned long long value) {
+   format_out_t out = { buf, size, 0 };
+   do_int(&out, spec, value);
+   return finish(&out);
+}
+
+int format_double(char *buf, int size, const format_spec_t *spec, double value) {
+   format_out_t out = { buf, size, 0 };
+   do_double(&out, spec, value);
+   return finish(&out);
+}
+
+int format_string(char *buf, int size, const format_spec_t *spec, const char *s) {
+   format_out_t out = { buf, size, 0 };
+   do_string(&out, spec, s);
+   return finish(&out);
+}
+
+int format_vsnprintf(char *buf, int size, const char *fmt, va_list ap) {
+   format_out_t out = { buf, size, 0 };
+   format_spec_t spec;
+   while (*fmt) {
+      if (*fmt != '%') {
+         put_char(&out, *fmt++);
+         continue;
+      }
+      fmt = format_parse(fmt + 1, &spec);
+      if (spec.width == FORMAT_STAR) {
+         spec.width = va_arg(ap, int);
+         if (spec.width < 0) {
+            spec.flags |= FORMAT_LEFT;
+            spec.width = -spec.width;
+         }
+      }
+      if (spec.precision == FORMAT_STAR) {
+         spec.precision = va_arg(ap, int);
+      }
+      switch (spec.conv) {
+      case 'd': case 'i': case 'u': case 'o': case 'x': case 'X': case 'c':
+         if (format_is_long_long(&spec)) {
+            do_int(&out, &spec, va_arg(ap, unsigned long long));
+         } else {
+            do_int(&out, &spec, va_arg(ap, unsigned int));
+         }
+         break;
+      case 'p':
+         do_int(&out, &spec, (unsigned long long) (unsigned long) va_arg(ap, void *));
+         break;
+      case 'f': case 'F': case 'e': case 'E': case 'g': case 'G':
+         do_double(&out, &spec, va_arg(ap, double));
+         break;
+      case 's':
+         do_string(&out, &spec, va_arg(ap, const char *));
+         break;
+      case '\0':
+         return finish(&out);
+      default:
+         put_char(&out, spec.conv);
+         break;
+      }
+      fmt++;
+   }
+   return finish(&out);
+}
+
+int format_snprintf(char *buf, int size, const char *fmt, ...) {
+   int len;
+   va_list ap;
+   va_start(ap, fmt);
+   len = format_vsnprintf(buf, size, fmt, ap);
+   va_end(ap);
+   return len;
+}
+
+int format_sprintf(char *buf, const char *fmt, ...) {
+   int len;
+   va_list ap;
+   va_start(ap, fmt);
+   len = format_vsnprintf(buf, 0x7fffffff, fmt, ap);
+   va_end(ap);
+   return len;
+}
@@ -0,0 +1,66 @@
+// format.h
+
+#ifndef FORMAT_H
+#define FORMAT_H
+
+#include <stdarg.h>
+
+// A small printf-style formatter, used in place of newlib's printf family
+// so that the (large and slow) floating point formatting code in newlib is
+// not linked into the kernel image.
+//
+// Supported: flags "-+ #0", width and precision (including *), the length
+// modifiers h, l, ll, z, j, t, L, and the conversions d i u o x X c s p %.
+//
+// Floating point conversions are done in fixed point, via a 64-bit integer:
+// - %f and %F print up to 9 fractional digits (6 by default)
+// - %e and %E are printed as %f
+// - %g and %G are printed as %f, with trailing zeros removed
+// Values too large to scale into 64 bits are printed as "inf".
+
+// Flags
+#define FORMAT_LEFT      0x01
+#define FORMAT_PLUS      0x02
+#define FORMAT_SPACE     0x04
+#define FORMAT_ALT       0x08
+#define FORMAT_ZERO      0x10
+
+// Width or precision value meaning "taken from the argument list"
+#define FORMAT_STAR      (-2)
+
+typedef struct {
+   int flags;
+   int width;      // -1 if absent
+   int precision;  // -1 if absent
+   int longs;      // number of l modifiers (ll = 2)
+   char conv;      // conversion character, or 0 if the format ended early
+} format_spec_t;
+
+// Parse the conversion specification starting just after a %
+// Returns a pointer to the conversion character
+extern const char *format_parse(const char *p, format_spec_t *spec);
+
+// Returns non-zero if the conversion takes a 64-bit integer argument
+extern int format_is_long_long(const format_spec_t *spec);
+
+// Format a single value, returning the number of characters written
+// (excluding the terminator). The output is always terminated, and
+// truncated if necessary.
+//
+// For integer conversions, value holds the raw argument bits; only the
+// low 32 bits are used unless format_is_long_long() is true.
+extern int format_int(char *buf, int size, const format_spec_t *spec, unsigned long long value);
+
+extern int format_double(char *buf, int size, const format_spec_t *spec, double value);
+
+extern int format_string(char *buf, int size, const format_spec_t *spec, const char *s);
+
+// printf-style wrappers, returning the number of characters written
+extern int format_vsnprintf(char *buf, int size, const char *fmt, va_list ap);
+
+extern int format_snprintf(char *buf, int size, const char *fmt, ...);
+
+// As sprintf, the caller must ensure buf is large enough
+extern int format_sprintf(char *buf, const char *fmt, ...);
+
+#endif
@@ -0,0 +1,406 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include "defs.h"
+#include "genlock.h"
+#include "logging.h"
+#include "osd.h"
+#include "rpi-base.h"
+#include "telemetry.h"
+
+// The genlock code only touches the hardware through the cprman, pixelvalve
+// and hdmi pointers, so that tools/genlock_sim.c can back them with
+// plain memory and run this file unmodified on the host.
+
+// PIXELVALVE2 register offsets (in words)
+#define PV_HORZA 3
+#define PV_HORZB 4
+#define PV_VERTA 5
+#define PV_VERTB 6
+
+// HDMI core register offsets (in words), which duplicate the PIXELVALVE2 timing
+#define HDMI_VERTA0 (0xcc/4)
+#define HDMI_VERTA1 (0xd4/4)
+
+// HDMI_VERTA[19:13] - vertical front porch in lines
+#define HDMI_VERTA_VFP_SHIFT 13
+#define HDMI_VERTA_VFP_MASK  (0x7F << HDMI_VERTA_VFP_SHIFT)
+#define HDMI_MAX_VFP         0x7F
+
+// Genlock PI controller, which steers PLLH around the exact frequency each field
+//
+// At ~312 lines per field, a 1ppm HDMI clock error moves the vsync by ~312e-6
+// lines per field, so KP = 200 ppm/line gives a closed loop time constant of
+// ~16 fields. The integral term absorbs any residual error in the measured
+// vsync_time_ns, so the lock holds indefinitely without ReSync slips.
+#define GENLOCK_KP          200.0  // ppm per line of error
+#define GENLOCK_KI            2.0  // ppm per line of error per field
+#define GENLOCK_MAX_PPM    2000.0  // maximum adjustment, as the old 2000ppm modes
+#define GENLOCK_LOCK_ERROR      1  // lines of error considered to be locked
+#define GENLOCK_LOCK_FIELDS    16  // fields within GENLOCK_LOCK_ERROR to declare lock
+
+// =============================================================
+// Local variables
+// =============================================================
+
+// Calculated so that the constants from librpitx work
+static volatile uint32_t *cprman = (volatile uint32_t *)(PERIPHERAL_BASE + 0x101000UL);
+
+static volatile uint32_t *pixelvalve = (volatile uint32_t *)(PERIPHERAL_BASE + 0x807000UL);
+
+static volatile uint32_t *hdmi = (volatile uint32_t *)(PERIPHERAL_BASE + 0x902000UL);
+
+static int frame_time_ns = 0;
+static double pllh_clock = 0;
+static double pllh_exact = 0;
+static double source_drift_ppm = 0;
+static int genlocked = 0;
+static int genlock_count = 0;
+static int genlock_integral = 0;
+static int resync_count = 0;
+static int lock_failed = 0;
+static int current_vlockmode = -1;
+static int mode_match = 0;
+static int original_vfp = -1;
+
+// =============================================================
+// Private methods
+// =============================================================
+
+// The clock manager password byte always reads back as zero on the hardware
+static inline uint32_t cm_read(int reg) {
+   return cprman[reg] & 0x00FFFFFF;
+}
+
+// Program PLLH to the frequency f2 (in MHz)
+//
+// This is called every field by the genlock controller, so it only
+// logs when something goes wrong.
+static void set_pllh_clock(double f2) {
+   // PLLH seems to use a fixed divider of 10 to generate the pixel clock,
+   // plus an additional divider that is used to get very low pixel clock rates
+   double pix_divider = 10.0 * ((double) cm_read(PLLH_PIX));
+
+   // Keep the HDMI pixel clock within limits
+   if (f2 < MIN_PIXEL_CLOCK * pix_divider) {
+      f2 = MIN_PIXEL_CLOCK * pix_divider;
+   } else if (f2 > MAX_PIXEL_CLOCK * pix_divider) {
+      f2 = MAX_PIXEL_CLOCK * pix_divider;
+   }
+
+   // Calculate the new dividers
+   int div = (int) (f2 / 19.2);
+   int fract = (int) ((double)(1<<20) * (f2 / 19.2 - (double) div));
+   // Sanity check the range of the fractional divider (it should actually always be in range)
+   if (fract < 0) {
+      log_warn("PLLH fraction < 0");
+      fract = 0;
+   }
+   if (fract > (1<<20) - 1) {
+      log_warn("PLLH fraction > 1");
+      fract = (1<<20) - 1;
+   }
+   // Update the integer divider
+   int old_ctrl = cm_read(PLLH_CTRL);
+   int old_div = old_ctrl & 0x3ff;
+   if (div != old_div) {
+      cprman[PLLH_CTRL] = 0x5A000000 | (old_ctrl & 0x00FFFC00) | div;
+      int new_ctrl = cm_read(PLLH_CTRL);
+      int new_div = new_ctrl & 0x3ff;
+      if (new_div != div) {
+         log_warn("Failed to write int divider: wrote %d, read back %d", div, new_div);
+      }
+   }
+
+   // Update the Fractional Divider
+   int old_fract = cm_read(PLLH_FRAC);
+   if (fract != old_fract) {
+      cprman[PLLH_FRAC] = 0x5A000000 | fract;
+      int new_fract = cm_read(PLLH_FRAC);
+      if (new_fract != fract) {
+         log_warn("Failed to write fract divider: wrote %d, read back %d", fract, new_fract);
+      }
+   }
+}
+
+// Set the vertical front porch, in both the PIXELVALVE2 and the HDMI core
+//
+// This takes effect from the next HDMI frame.
+static void set_vertical_front_porch(int vfp) {
+   pixelvalve[PV_VERTB] = (vfp << 16) | (pixelvalve[PV_VERTB] & 0xFFFF);
+   hdmi[HDMI_VERTA0] = (hdmi[HDMI_VERTA0] & ~HDMI_VERTA_VFP_MASK) | (vfp << HDMI_VERTA_VFP_SHIFT);
+   hdmi[HDMI_VERTA1] = (hdmi[HDMI_VERTA1] & ~HDMI_VERTA_VFP_MASK) | (vfp << HDMI_VERTA_VFP_SHIFT);
+}
+
+// Build an HDMI mode whose refresh rate matches the source, by keeping the
+// active area, sync and back porch of the booted mode and choosing the vertical
+// front porch that gets vtotal closest to the source field time. PLLH then only
+// has to correct the residual (less than half a line) error.
+//
+// Returns the new vtotal.
+static uint32_t build_matched_mode(int vlockmode, double pixel_clock, uint32_t htotal, uint32_t vtotal) {
+   int current_vfp = pixelvalve[PV_VERTB] >> 16;
+   int fixed_lines = vtotal - current_vfp;
+   int vfp;
+   // Grab the original front porch once, so it can be restored
+   if (original_vfp < 0) {
+      original_vfp = current_vfp;
+   }
+   vfp = original_vfp;
+   if (mode_match && vlockmode > 0) {
+      // Lines per source field at the original pixel clock (in MHz)
+      double lines = pixel_clock * ((double) frame_time_ns) / 2000.0 / ((double) htotal);
+      vfp = (int) (lines + 0.5) - fixed_lines;
+      if (vfp < 1) {
+         vfp = 1;
+      } else if (vfp > HDMI_MAX_VFP) {
+         vfp = HDMI_MAX_VFP;
+      }
+   }
+   if (vfp != current_vfp) {
+      log_info("Setting HDMI vertical front porch to %d lines (V-Total %d)", vfp, fixed_lines + vfp);
+      set_vertical_front_porch(vfp);
+   }
+   return fixed_lines + vfp;
+}
+
+static void recalculate_hdmi_clock(int vlockmode) {  // use local vsyncmode, not global
+   // The very first time we get called, frame_time_ns has not been set
+   // so exit gracefully
+   if (frame_time_ns == 0) {
+      return;
+   }
+
+   // Dump the PLLH registers
+   log_debug("PLLH: PDIV=%d NDIV=%d FRAC=%d AUX=%d RCAL=%d PIX=%d STS=%d",
+             (cm_read(PLLH_CTRL) >> 12) & 0x7,
+             cm_read(PLLH_CTRL) & 0x3ff,
+             cm_read(PLLH_FRAC),
+             cm_read(PLLH_AUX),
+             cm_read(PLLH_RCAL),
+             cm_read(PLLH_PIX),
+             cm_read(PLLH_STS));
+
+   // Grab the original PLLH frequency once, at it's original value
+   if (pllh_clock == 0) {
+      pllh_clock = 19.2 * ((double)(cm_read(PLLH_CTRL) & 0x3ff) + ((double)cm_read(PLLH_FRAC)) / ((double)(1 << 20)));
+   }
+
+   //for (int i = 0; i < 32; i++) {
+   //   log_debug("   PIXELVALVE2[%2d]: %08x", i, pixelvalve[i]);
+   //}
+
+   // Dump the PIXELVALVE2 registers
+   log_debug(" PIXELVALVE2_HORZA: %08x", pixelvalve[PV_HORZA]);
+   log_debug(" PIXELVALVE2_HORZB: %08x", pixelvalve[PV_HORZB]);
+   log_debug(" PIXELVALVE2_VERTA: %08x", pixelvalve[PV_VERTA]);
+   log_debug(" PIXELVALVE2_VERTB: %08x", pixelvalve[PV_VERTB]);
+
+   // Work out the htotal and vtotal by summing the four  16-bit values:
+   // A[31:16] - back porch width in pixels
+   // A[15: 0] - synch width in pixels
+   // B[31:16] - front porch width in pixels
+   // B[15: 0] - active line width in pixels
+   uint32_t htotal = pixelvalve[PV_HORZA] + pixelvalve[PV_HORZB];
+   htotal = (htotal + (htotal >> 16)) & 0xFFFF;
+   uint32_t vtotal = pixelvalve[PV_VERTA] + pixelvalve[PV_VERTB];
+   vtotal = (vtotal + (vtotal >> 16)) & 0xFFFF;
+   log_debug("           H-Total: %d pixels", htotal);
+   log_debug("           V-Total: %d pixels", vtotal);
+
+   // PLLH seems to use a fixed divider to generate the pixel clock
+   int fixed_divider = 10;
+   log_debug("     Fixed divider: %d", fixed_divider);
+
+   // 720x576@50    PLLH: PDIV=1 NDIV=56 FRAC=262144 AUX=256 RCAL=256 PIX=4 STS=526655
+   // 1920x1080@50  PLLH: PDIV=1 NDIV=77 FRAC=360448 AUX=256 RCAL=256 PIX=1 STS=526655
+   //     An additional divider is used to get very low pixel clock rates ^
+   int additional_divider = cm_read(PLLH_PIX);
+   log_debug("Additional divider: %d", additional_divider);
+
+   // Calculate the pixel clock
+   double pixel_clock = pllh_clock / ((double) fixed_divider) / ((double) additional_divider);
+   log_debug("       Pixel Clock: %lf MHz", pixel_clock);
+
+   // Optionally rebuild the vertical timing, so only the residual error needs the pixel clock
+   vtotal = build_matched_mode(vlockmode, pixel_clock, htotal, vtotal);
+
+   // Calculate the error between the HDMI VSync and the Source VSync
+   double source_vsync_freq = 2e9 / ((double) frame_time_ns);
+   double display_vsync_freq = 1e6 * pixel_clock / ((double) htotal) / ((double) vtotal);
+   double error = display_vsync_freq / source_vsync_freq;
+   double error_ppm = 1e6 * (error - 1.0);
+   double f2 = pllh_clock;
+   if (vlockmode > 0) {
+      f2 /= error;
+      f2 /= 1.0 + ((double) (HDMI_EXACT - vlockmode)) / 1000.0;
+   }
+
+   // Sanity check HDMI pixel clock
+   pixel_clock = f2 / ((double) fixed_divider) / ((double) additional_divider);
+   if (pixel_clock < MIN_PIXEL_CLOCK) {
+      log_warn("Pixel clock of %.2lf MHz is too low; leaving unchanged", pixel_clock);
+      f2 = pllh_clock;
+   } else if (pixel_clock > MAX_PIXEL_CLOCK) {
+      log_warn("Pixel clock of %.2lf MHz is too high; leaving unchanged", pixel_clock);
+      f2 = pllh_clock;
+   }
+
+   // Remember the PLLH frequency that exactly matches the source, for the genlock controller
+   pllh_exact = pllh_clock / error;
+
+   log_debug(" Source vsync freq: %lf Hz (measured)",  source_vsync_freq);
+   log_debug("Display vsync freq: %lf Hz",  display_vsync_freq);
+   log_debug("       Vsync error: %lf ppm", error_ppm);
+   log_debug("     Original PLLH: %lf MHz", pllh_clock);
+   log_debug("       Target PLLH: %lf MHz", f2);
+
+   set_pllh_clock(f2);
+
+   // Dump the the actual PLL frequency
+   double f3 = 19.2 * ((double)(cm_read(PLLH_CTRL) & 0x3ff) + ((double)cm_read(PLLH_FRAC)) / ((double)(1 << 20)));
+   log_debug("        Final PLLH: %lf MHz", f3);
+
+   log_debug("PLLH: PDIV=%d NDIV=%d FRAC=%d AUX=%d RCAL=%d PIX=%d STS=%d",
+             (cm_read(PLLH_CTRL) >> 12) & 0x7,
+             cm_read(PLLH_CTRL) & 0x3ff,
+             cm_read(PLLH_FRAC),
+             cm_read(PLLH_AUX),
+             cm_read(PLLH_RCAL),
+             cm_read(PLLH_PIX),
+             cm_read(PLLH_STS));
+}
+
+static void recalculate_hdmi_clock_once(int vlockmode) {
+   if (current_vlockmode != vlockmode){
+      current_vlockmode = vlockmode;
+      recalculate_hdmi_clock(vlockmode);
+   }
+}
+
+// =============================================================
+// Public methods
+// =============================================================
+
+void genlock_set_registers(volatile uint32_t *cm, volatile uint32_t *pv, volatile uint32_t *hd) {
+   cprman = cm;
+   pixelvalve = pv;
+   hdmi = hd;
+   pllh_clock = 0;
+   pllh_exact = 0;
+   original_vfp = -1;
+   current_vlockmode = -1;
+}
+
+void genlock_set_mode_match(int on) {
+   mode_match = on;
+   current_vlockmode = -1;
+}
+
+void genlock_invalidate() {
+   current_vlockmode = -1;
+}
+
+void genlock_reset() {
+   genlocked = 0;
+   genlock_count = 0;
+   genlock_integral = 0;
+   resync_count = 0;
+}
+
+int genlock_is_locked() {
+   return genlocked;
+}
+
+int genlock_lock_failed() {
+   return lock_failed;
+}
+
+void genlock_set_source_drift(double ppm) {
+   source_drift_ppm = ppm;
+}
+
+int genlock_resync_count() {
+   return resync_count;
+}
+
+int genlock_vsync_to_active_ns() {
+   int pix = cm_read(PLLH_PIX);
+   if (pix == 0) {
+      return 0;
+   }
+   // The vsync interrupt is at the start of the vsync pulse, which is
+   // followed by the back porch: VERTA[31:16] back porch, VERTA[15:0] sync
+   uint32_t lines = (pixelvalve[PV_VERTA] >> 16) + (pixelvalve[PV_VERTA] & 0xFFFF);
+   uint32_t htotal = pixelvalve[PV_HORZA] + pixelvalve[PV_HORZB];
+   htotal = (htotal + (htotal >> 16)) & 0xFFFF;
+   double pixel_clock = 19.2 * ((double)(cm_read(PLLH_CTRL) & 0x3ff) + ((double)cm_read(PLLH_FRAC)) / ((double)(1 << 20))) / 10.0 / ((double) pix);
+   return (int) (1e3 * ((double) (htotal * lines)) / pixel_clock);
+}
+
+int genlock_update(int vlockmode, int vlockline, int vsync_line, int height, int vsync_time_ns) {
+   lock_failed = 0;
+   frame_time_ns = vsync_time_ns;
+   if (vlockmode != HDMI_EXACT) {
+      genlocked = 0;
+      genlock_count = 0;
+      genlock_integral = 0;
+      resync_count = 0;
+      recalculate_hdmi_clock_once(vlockmode);
+   } else {
+      // Make sure pllh_exact is up to date (this does nothing most fields)
+      recalculate_hdmi_clock_once(HDMI_EXACT);
+      if (pllh_exact == 0) {
+         return 1;
+      }
+      signed int difference = vsync_line - vlockline;
+      if (abs(difference) > height/4) {
+         difference = -difference;
+      }
+      if (genlocked && abs(difference) > GENLOCK_LOCK_ERROR + 1) {
+         genlocked = 0;
+         genlock_count = 0;
+         if (abs(difference) > GENLOCK_LOCK_ERROR + 2) {
+            log_info("Lock lost probably due to mode change - resetting ReSync counter");
+            resync_count = 0;
+            genlock_integral = 0;
+            lock_failed = 1;
+         } else {
+            // With the integral term, this should only happen if the source clock jumps
+            log_info("ReSync: %d %d", ++resync_count, difference);
+            telemetry_event(TM_RESYNC, 0, resync_count);
+         }
+      }
+
+      // A positive difference needs the HDMI clock to be slowed down (see vlockmode)
+      double ppm = -GENLOCK_KP * (double) difference - GENLOCK_KI * genlock_integral;
+      if (ppm > GENLOCK_MAX_PPM) {
+         ppm = GENLOCK_MAX_PPM;
+      } else if (ppm < -GENLOCK_MAX_PPM) {
+         ppm = -GENLOCK_MAX_PPM;
+      } else {
+         // Only integrate when the output is not saturated, to avoid wind-up
+         genlock_integral += difference;
+      }
+      set_pllh_clock(pllh_exact / (1.0 + source_drift_ppm * 1e-6) * (1.0 + ppm * 1e-6));
+
+      if (abs(difference) <= GENLOCK_LOCK_ERROR) {
+         if (!genlocked && ++genlock_count >= GENLOCK_LOCK_FIELDS) {
+            genlocked = 1;
+            log_info("Locked");
+         }
+      } else {
+         genlock_count = 0;
+      }
+   }
+   if (vlockmode == HDMI_EXACT) {
+      telemetry_event(TM_GENLOCK, genlocked, vsync_line - vlockline);
+   }
+   if (vlockmode != HDMI_EXACT) {
+      // Return 0 if genlock disabled
+      return 0;
+   } else {
+      // Return 1 if genlock enabled but not yet locked
+      // Return 2 if genlock enabled and locked
+      return 1 + genlocked;
+   }
+}
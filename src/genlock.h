@@ -0,0 +1,44 @@
+// genlock.h
+
+#ifndef GENLOCK_H
+#define GENLOCK_H
+
+#include <stdint.h>
+
+// Redirect the clock manager, PIXELVALVE2 and HDMI register accesses
+// (only used by the host simulator, tools/genlock_sim.c)
+extern void genlock_set_registers(volatile uint32_t *cm, volatile uint32_t *pv, volatile uint32_t *hd);
+
+// Enable rebuilding the HDMI vertical timing to match the source refresh rate,
+// in addition to adjusting the pixel clock
+extern void genlock_set_mode_match(int on);
+
+// Force the HDMI clock to be recalculated, e.g. when vsync_time_ns changes
+extern void genlock_invalidate();
+
+// Reset the lock state, the controller's integral term and the ReSync counter
+extern void genlock_reset();
+
+// Update the HDMI clock, called once per field
+// - vsync_line is the capture line at which the last HDMI vsync occurred
+// - vsync_time_ns is the measured source frame time
+// Returns 0 if genlock disabled, 1 if not yet locked, 2 if locked
+extern int genlock_update(int vlockmode, int vlockline, int vsync_line, int height, int vsync_time_ns);
+
+extern int genlock_is_locked();
+
+// Returns 1 if the last update lost lock badly enough to need recalibration
+extern int genlock_lock_failed();
+
+extern int genlock_resync_count();
+
+// Feed forward a change in the source line period (in ppm, positive is
+// slower) since vsync_time_ns was measured, so the controller doesn't
+// have to integrate it out
+extern void genlock_set_source_drift(double ppm);
+
+// Returns the time from the HDMI vsync to the first active line, in ns,
+// from the current PIXELVALVE2 timing and pixel clock
+extern int genlock_vsync_to_active_ns();
+
+#endif
@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <string.h>
+#include "format.h"
 #include "info.h"
 #include "logging.h"
 
@@ -96,7 +97,7 @@ int get_speed() {
 char *get_info_string() {
    static int read = 0;
    if (!read) {
-      sprintf(info_string, "%x %04d/%03dMHz %2.1fC", get_revision(), get_clock_rate(ARM_CLK_ID) / 1000000, get_clock_rate(CORE_CLK_ID) / 1000000, get_temp());
+      format_sprintf(info_string, "%x %04d/%03dMHz %2.1fC", get_revision(), get_clock_rate(ARM_CLK_ID) / 1000000, get_clock_rate(CORE_CLK_ID) / 1000000, get_temp());
       read = 1;
    }
    return info_string;
@@ -0,0 +1,142 @@
+#include <string.h>
+#include "defs.h"
+#include "genlock.h"
+#include "info.h"
+#include "latency.h"
+#include "rgb_to_fb.h"
+#include "telemetry.h"
+
+// =============================================================
+// Local variables
+// =============================================================
+
+typedef struct {
+   int valid;
+   int buffer;
+   unsigned int start;   // end of the source vsync
+   unsigned int end;     // end of capture
+} latency_field_t;
+
+static latency_stats_t stats;
+
+// ARM cycles per microsecond, cached as reading it needs a mailbox call
+static unsigned int arm_mhz;
+
+// The flip requested during this field
+static int requested = -1;
+
+// The flip waiting for an HDMI vsync
+static latency_field_t pending;
+
+static int displayed = -1;
+
+// blank_end_time is valid (i.e. set at the end of the previous field)
+static int blank_valid = 0;
+
+// =============================================================
+// Private methods
+// =============================================================
+
+static void record(unsigned int start, unsigned int end, unsigned int vsync, int active_ns, int in_place) {
+   unsigned int capture_us = (end - start) / arm_mhz;
+   unsigned int wait_us = (vsync - start) / arm_mhz;
+   unsigned int scanout_us = active_ns / 1000;
+   unsigned int total_us = wait_us + scanout_us;
+   stats.count++;
+   stats.last_us = total_us;
+   if (stats.count == 1 || total_us < stats.min_us) {
+      stats.min_us = total_us;
+   }
+   if (total_us > stats.max_us) {
+      stats.max_us = total_us;
+   }
+   stats.total_us += total_us;
+   // When drawing into the displayed buffer, the vsync can be before the end of capture
+   if (wait_us > capture_us) {
+      stats.capture_us += capture_us;
+      stats.flip_us += wait_us - capture_us;
+   } else {
+      stats.capture_us += wait_us;
+   }
+   stats.scanout_us += scanout_us;
+   telemetry_event(TM_LATENCY, in_place, total_us);
+}
+
+static void record_slack() {
+   if (line_slack_min != 0xFFFFFFFF) {
+      stats.line_slack_ns = line_slack_min * 1000 / arm_mhz;
+      if (stats.line_slack_min_ns == 0 || stats.line_slack_ns < stats.line_slack_min_ns) {
+         stats.line_slack_min_ns = stats.line_slack_ns;
+      }
+      telemetry_event(TM_SLACK, 0, stats.line_slack_ns);
+   }
+   if (blank_valid) {
+      stats.blank_slack_us = (capture_start_time - blank_end_time) / arm_mhz;
+      if (stats.blank_slack_min_us == 0 || stats.blank_slack_us < stats.blank_slack_min_us) {
+         stats.blank_slack_min_us = stats.blank_slack_us;
+      }
+      telemetry_event(TM_SLACK, 1, stats.blank_slack_us);
+   }
+   blank_valid = 1;
+}
+
+// =============================================================
+// Public methods
+// =============================================================
+
+void latency_reset() {
+   memset(&stats, 0, sizeof(stats));
+   arm_mhz = get_clock_rate(ARM_CLK_ID) / 1000000;
+   latency_restart();
+}
+
+void latency_restart() {
+   requested = -1;
+   pending.valid = 0;
+   displayed = -1;
+   blank_valid = 0;
+}
+
+void latency_flip_requested(int buffer) {
+   requested = buffer;
+}
+
+void latency_field(int flags) {
+   int active_ns;
+   if (arm_mhz == 0 || (flags & BIT_PROBE)) {
+      requested = -1;
+      return;
+   }
+   record_slack();
+
+   active_ns = genlock_vsync_to_active_ns();
+
+   // The first HDMI vsync of this field completes the flip requested last field
+   if (pending.valid) {
+      if (vsync_count) {
+         record(pending.start, pending.end, vsync_time, active_ns, 0);
+         displayed = pending.buffer;
+      } else {
+         stats.missed++;
+         displayed = -1;
+      }
+      pending.valid = 0;
+   }
+
+   if (requested >= 0 && requested != displayed) {
+      pending.valid = 1;
+      pending.buffer = requested;
+      pending.start = capture_start_time;
+      pending.end = capture_end_time;
+   } else if (vsync_count) {
+      // This field was drawn into the displayed buffer
+      record(capture_start_time, capture_end_time, vsync_time, active_ns, 1);
+   } else {
+      stats.missed++;
+   }
+   requested = -1;
+}
+
+const latency_stats_t *latency_get_stats() {
+   return &stats;
+}
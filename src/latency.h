@@ -0,0 +1,62 @@
+// latency.h
+
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdint.h>
+
+// Capture to display latency measurement
+//
+// rgb_to_fb timestamps (with the ARM cycle counter) the end of the source
+// vsync, the end of capture and the first HDMI vsync seen during each field.
+// The latency of a field is measured from the end of its source vsync to
+// the first active HDMI line that shows it:
+//
+// - Multi buffered: the flip requested at the end of the field takes effect
+//   at the next HDMI vsync, which is normally seen while the following field
+//   is being captured
+// - Single buffered (mode 7, beam racing): the field is drawn into the
+//   displayed buffer, so the first HDMI vsync during its own capture is used
+//
+// The HDMI vsync is only polled during the active capture lines, so if it
+// falls in the source blanking interval the field is counted as missed.
+// The time from the HDMI vsync to the first active line is calculated from
+// the PIXELVALVE2 timing, rather than measured.
+//
+// The slack in each field is also recorded: how close the capture of each
+// line runs to the next hsync, and how much of the blanking period is left
+// once the end of field work (OSD, cache clean, flip, logging) is done.
+
+typedef struct {
+   unsigned int count;      // fields measured
+   unsigned int missed;     // fields where the HDMI vsync was not seen
+   unsigned int last_us;
+   unsigned int min_us;
+   unsigned int max_us;
+   uint64_t total_us;
+   // Totals of each stage, for the means
+   uint64_t capture_us;     // source vsync to end of capture
+   uint64_t flip_us;        // end of capture to HDMI vsync
+   uint64_t scanout_us;     // HDMI vsync to the first active line
+   // Slack, i.e. time left over, for comparing framebuffer policies
+   unsigned int line_slack_ns;      // least time from the end of capturing a line to the next hsync, last field
+   unsigned int line_slack_min_ns;  // as above, over all fields
+   unsigned int blank_slack_us;     // time from the end of the blanking work to the next field, last field
+   unsigned int blank_slack_min_us; // as above, over all fields
+} latency_stats_t;
+
+// Clear the statistics, e.g. after a mode change
+extern void latency_reset();
+
+// Forget any flip in progress, called each time rgb_to_fb is (re)entered
+extern void latency_restart();
+
+// Called from swapBuffer() when a flip is requested
+extern void latency_flip_requested(int buffer);
+
+// Called once per field from rgb_to_fb, with the flags register
+extern void latency_field(int flags);
+
+extern const latency_stats_t *latency_get_stats();
+
+#endif
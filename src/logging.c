@@ -1,50 +1,340 @@
-#include <stdio.h>
 #include <stdarg.h>
+#include <string.h>
+#include "format.h"
 #include "logging.h"
+#include "rpi-aux.h"
+#include "rpi-systimer.h"
+#include "telemetry.h"
+
+// Log messages are not formatted when they are logged. Instead the format
+// string, the raw arguments and a timestamp are copied into a ring buffer,
+// and the (slow) formatting and UART output happen later, from log_drain(),
+// which rgb_to_fb calls in the vertical blanking period. Anything still
+// queued is written out by log_flush() on entry to rgb_to_fb, measure_vsync
+// and measure_n_lines, as these wait for the source's sync, and never return
+// without one.
+//
+// Once the text messages have been sent, any queued telemetry records are
+// sent, so the two never get interleaved mid-line or mid-frame.
+//
+// There is a single producer (log_*) and a single consumer (log_drain/log_flush),
+// so the ring needs no locking. If the ring fills up, the producer writes out
+// the oldest record itself, so nothing is lost.
+
+#define LOG_RING_SIZE      128  // Must be a power of 2
+#define LOG_ARG_WORDS       16
+#define LOG_STRING_SIZE    128
+#define LOG_LINE_SIZE      256
+
+// Time budget for each call to log_drain
+#define LOG_DRAIN_BUDGET_US 1000
+
+typedef struct {
+   uint32_t    timestamp;
+   const char *prefix;
+   const char *fmt;
+   int         nwords;
+   uint32_t    args[LOG_ARG_WORDS];
+   char        strings[LOG_STRING_SIZE];
+} log_record_t;
+
+// =============================================================
+// Local variables
+// =============================================================
+
+static log_record_t log_ring[LOG_RING_SIZE];
+
+static volatile unsigned int log_head;
+static volatile unsigned int log_tail;
+
+// The record currently being sent to the UART
+static char line[LOG_LINE_SIZE];
+static int line_len;
+static int line_pos;
+
+// =============================================================
+// Private methods
+// =============================================================
+
+// Argument classes, as determined by parsing the format string
+enum {
+   ARG_NONE,
+   ARG_INT,
+   ARG_LONG_LONG,
+   ARG_DOUBLE,
+   ARG_POINTER,
+   ARG_STRING
+};
+
+static int arg_class(const format_spec_t *spec) {
+   switch (spec->conv) {
+   case 'd': case 'i': case 'u': case 'o': case 'x': case 'X': case 'c':
+      return format_is_long_long(spec) ? ARG_LONG_LONG : ARG_INT;
+   case 'f': case 'F': case 'e': case 'E': case 'g': case 'G':
+      return ARG_DOUBLE;
+   case 'p':
+      return ARG_POINTER;
+   case 's':
+      return ARG_STRING;
+   default:
+      return ARG_NONE;
+   }
+}
+
+static void put_words(log_record_t *rec, const void *value, int size) {
+   int nwords = (size + 3) >> 2;
+   if (rec->nwords + nwords <= LOG_ARG_WORDS) {
+      memcpy(&rec->args[rec->nwords], value, size);
+   }
+   rec->nwords += nwords;
+}
+
+static void get_words(log_record_t *rec, int *index, void *value, int size) {
+   int nwords = (size + 3) >> 2;
+   if (*index + nwords <= LOG_ARG_WORDS) {
+      memcpy(value, &rec->args[*index], size);
+   } else {
+      memset(value, 0, size);
+   }
+   *index += nwords;
+}
+
+// Capture the arguments, according to the format string
+static void capture_args(log_record_t *rec, va_list ap) {
+   const char *p = rec->fmt;
+   format_spec_t spec;
+   int string_used = 0;
+   rec->nwords = 0;
+   while (*p) {
+      if (*p++ != '%') {
+         continue;
+      }
+      if (*p == '%') {
+         p++;
+         continue;
+      }
+      p = format_parse(p, &spec);
+      if (spec.width == FORMAT_STAR) {
+         int i = va_arg(ap, int);
+         put_words(rec, &i, sizeof(i));
+      }
+      if (spec.precision == FORMAT_STAR) {
+         int i = va_arg(ap, int);
+         put_words(rec, &i, sizeof(i));
+      }
+      switch (arg_class(&spec)) {
+      case ARG_INT: {
+         int i = va_arg(ap, int);
+         put_words(rec, &i, sizeof(i));
+         break;
+      }
+      case ARG_LONG_LONG: {
+         long long ll = va_arg(ap, long long);
+         put_words(rec, &ll, sizeof(ll));
+         break;
+      }
+      case ARG_DOUBLE: {
+         double d = va_arg(ap, double);
+         put_words(rec, &d, sizeof(d));
+         break;
+      }
+      case ARG_POINTER: {
+         void *ptr = va_arg(ap, void *);
+         put_words(rec, &ptr, sizeof(ptr));
+         break;
+      }
+      case ARG_STRING: {
+         // Strings are copied, as they are often in temporary buffers
+         const char *s = va_arg(ap, const char *);
+         int offset = string_used;
+         int avail = LOG_STRING_SIZE - 1 - string_used;
+         if (avail < 0) {
+            // No space left, so point at the terminator of the last string, i.e. an empty string
+            offset = LOG_STRING_SIZE - 1;
+         } else {
+            int len = s ? strlen(s) : 0;
+            if (len > avail) {
+               len = avail;
+            }
+            memcpy(rec->strings + string_used, s, len);
+            string_used += len;
+            rec->strings[string_used++] = '\0';
+         }
+         put_words(rec, &offset, sizeof(offset));
+         break;
+      }
+      }
+      if (*p) {
+         p++;
+      }
+   }
+}
+
+// Format a record into line[], returning the length
+static int format_record(log_record_t *rec) {
+   const char *p = rec->fmt;
+   format_spec_t spec;
+   int size = LOG_LINE_SIZE - 2;  // Leave space for the CR/LF
+   int index = 0;
+   int len;
+   len = format_snprintf(line, size, "[%4u.%06u] %s",
+                         (unsigned int) (rec->timestamp / 1000000),
+                         (unsigned int) (rec->timestamp % 1000000),
+                         rec->prefix);
+   while (*p && len < size - 1) {
+      if (*p != '%' || p[1] == '%') {
+         line[len++] = *p;
+         p += (*p == '%') ? 2 : 1;
+         continue;
+      }
+      p = format_parse(p + 1, &spec);
+      if (spec.width == FORMAT_STAR) {
+         get_words(rec, &index, &spec.width, sizeof(spec.width));
+         if (spec.width < 0) {
+            spec.flags |= FORMAT_LEFT;
+            spec.width = -spec.width;
+         }
+      }
+      if (spec.precision == FORMAT_STAR) {
+         get_words(rec, &index, &spec.precision, sizeof(spec.precision));
+      }
+      switch (arg_class(&spec)) {
+      case ARG_INT: {
+         unsigned int i;
+         get_words(rec, &index, &i, sizeof(i));
+         len += format_int(line + len, size - len, &spec, i);
+         break;
+      }
+      case ARG_LONG_LONG: {
+         unsigned long long ll;
+         get_words(rec, &index, &ll, sizeof(ll));
+         len += format_int(line + len, size - len, &spec, ll);
+         break;
+      }
+      case ARG_DOUBLE: {
+         double d;
+         get_words(rec, &index, &d, sizeof(d));
+         len += format_double(line + len, size - len, &spec, d);
+         break;
+      }
+      case ARG_POINTER: {
+         void *ptr;
+         get_words(rec, &index, &ptr, sizeof(ptr));
+         len += format_int(line + len, size - len, &spec, (unsigned long) ptr);
+         break;
+      }
+      case ARG_STRING: {
+         int offset;
+         get_words(rec, &index, &offset, sizeof(offset));
+         len += format_string(line + len, size - len, &spec, rec->strings + offset);
+         break;
+      }
+      }
+      if (*p) {
+         p++;
+      }
+   }
+   line[len++] = '\r';
+   line[len++] = '\n';
+   return len;
+}
+
+// Send (part of) the next record to the UART
+// Returns 0 when there is nothing left to send, -1 if the UART FIFO filled
+// up (non-blocking only), otherwise 1
+static int output_record(int blocking) {
+   if (line_pos == line_len) {
+      line_pos = 0;
+      if (log_tail != log_head) {
+         line_len = format_record(&log_ring[log_tail]);
+         log_tail = (log_tail + 1) & (LOG_RING_SIZE - 1);
+      } else {
+         line_len = telemetry_frame(line, LOG_LINE_SIZE);
+         if (line_len == 0) {
+            return 0;
+         }
+      }
+   }
+   while (line_pos < line_len) {
+      if (blocking) {
+         RPI_AuxMiniUartWrite(line[line_pos++]);
+      } else if (RPI_AuxMiniUartTryWrite(line[line_pos])) {
+         line_pos++;
+      } else {
+         return -1;
+      }
+   }
+   return 1;
+}
+
+static void log_record(const char *prefix, const char *fmt, va_list ap) {
+   unsigned int head = log_head;
+   unsigned int next = (head + 1) & (LOG_RING_SIZE - 1);
+   // If the ring is full, make space by writing out the oldest record
+   while (next == log_tail) {
+      output_record(1);
+   }
+   log_record_t *rec = &log_ring[head];
+   rec->timestamp = RPI_GetSystemTimer();
+   rec->prefix = prefix;
+   rec->fmt = fmt;
+   capture_args(rec, ap);
+   log_head = next;
+}
+
+// =============================================================
+// Public methods
+// =============================================================
+
+void log_drain() {
+   uint32_t start = RPI_GetSystemTimer();
+   // Stop as soon as the FIFO is full, rather than wait for it to empty
+   while (output_record(0) > 0) {
+      if (RPI_GetSystemTimer() - start > LOG_DRAIN_BUDGET_US) {
+         break;
+      }
+   }
+}
+
+void log_flush() {
+   while (output_record(1));
+   while (!RPI_AuxMiniUartTxIdle());
+}
 
 #ifdef DEBUG
 void log_debug(const char *fmt, ...) {
    va_list ap;
-   printf("DEBUG: ");
    va_start(ap, fmt);
-   vprintf(fmt, ap);
+   log_record("DEBUG: ", fmt, ap);
    va_end(ap);
-   printf("\r\n");
 }
 #endif
 
 void log_info(const char *fmt, ...) {
    va_list ap;
-   printf("INFO: ");
    va_start(ap, fmt);
-   vprintf(fmt, ap);
+   log_record("INFO: ", fmt, ap);
    va_end(ap);
-   printf("\r\n");
 }
 
 void log_warn(const char *fmt, ...) {
    va_list ap;
-   printf("WARN: ");
    va_start(ap, fmt);
-   vprintf(fmt, ap);
+   log_record("WARN: ", fmt, ap);
    va_end(ap);
-   printf("\r\n");
 }
 
 void log_error(const char *fmt, ...) {
    va_list ap;
-   printf("ERROR: ");
    va_start(ap, fmt);
-   vprintf(fmt, ap);
+   log_record("ERROR: ", fmt, ap);
    va_end(ap);
-   printf("\r\n");
 }
 
 void log_fatal(const char *fmt, ...) {
    va_list ap;
-   printf("FATAL: ");
    va_start(ap, fmt);
-   vprintf(fmt, ap);
+   log_record("FATAL: ", fmt, ap);
    va_end(ap);
-   printf("\r\n");
+   log_flush();
 }
@@ -17,4 +17,10 @@ extern void log_error(const char *fmt, ...);
 
 extern void log_fatal(const char *fmt, ...);
 
+// Write out some queued log messages, without blocking for too long
+extern void log_drain();
+
+// Write out all queued log messages, and wait for the UART to be idle
+extern void log_flush();
+
 #endif
@@ -0,0 +1,255 @@
+#include <string.h>
+#include "defs.h"
+#include "latency.h"
+#include "logging.h"
+#include "majority.h"
+#include "rpi-systimer.h"
+
+// Maximum time budget for filtering at the end of each field, on a single core Pi
+#define MAJORITY_BUDGET_US  800
+
+// Blanking time to leave spare after all the end of field work
+#define MAJORITY_MARGIN_US  200
+
+// A blanking slack longer than this means the end of field work overran, and a field was missed
+#define MAJORITY_OVERRUN_US 5000
+
+// How long core 0 waits for core 1 to finish the last lines of a field
+#define MAJORITY_WAIT_US   200
+
+typedef struct {
+   int active;
+   unsigned int *fb;    // draw buffer
+   int pitch;           // frame buffer pitch, in words
+   int words;           // words captured per line
+   int nlines;
+   int copy;            // each captured line is repeated on the next frame buffer line
+   int bpp;
+   unsigned int field;
+} majority_job_t;
+
+// =============================================================
+// Local variables
+// =============================================================
+
+// The last two captured fields; history[field & 1] holds the field before last
+static unsigned int history[2][MAJORITY_MAX_LINES][MAJORITY_LINE_BYTES / 4] __attribute__((aligned(64)));
+
+// The field each line was last recorded in, and how many consecutive fields that is (up to 2)
+static unsigned int recorded[MAJORITY_MAX_LINES];
+static unsigned char run[MAJORITY_MAX_LINES];
+
+static capture_info_t *capinfo;
+
+static majority_job_t job;
+
+static unsigned int field;
+
+#ifndef HAS_MULTICORE
+// The budget for this field, and the time used in each of the last two fields
+static int budget_us;
+static int used_us[2];
+#endif
+
+#ifdef HAS_MULTICORE
+volatile int majority_lines;
+
+// Incremented when each field starts, after job has been written
+static volatile unsigned int job_seq;
+
+// Progress of core 1 through the job
+static volatile unsigned int done_seq;
+static volatile int done_lines;
+
+// The last job core 1 has picked up, between lines
+static volatile unsigned int ack_seq;
+#endif
+
+// =============================================================
+// Private methods
+// =============================================================
+
+// Set every bit of each non-zero pixel
+static inline unsigned int pixel_mask(unsigned int x, int bpp) {
+   if (bpp == 4) {
+      x |= x >> 2;
+      x |= x >> 1;
+      return (x & 0x11111111) * 0xF;
+   } else {
+      x |= x >> 4;
+      x |= x >> 2;
+      x |= x >> 1;
+      return (x & 0x01010101) * 0xFF;
+   }
+}
+
+static void filter_line(const majority_job_t *j, int line) {
+   unsigned int *fb = j->fb + line * 2 * j->pitch;
+   unsigned int *prev1 = history[(j->field + 1) & 1][line];
+   unsigned int *prev2 = history[j->field & 1][line];
+
+   int have = (recorded[line] == j->field - 1) ? run[line] : 0;
+   recorded[line] = j->field;
+   run[line] = (have < 2) ? have + 1 : 2;
+
+   // The oldest field is replaced by this one as the line is filtered
+   if (have < 2) {
+      memcpy(prev2, fb, j->words * 4);
+      return;
+   }
+   for (int i = 0; i < j->words; i++) {
+      unsigned int a = fb[i];
+      unsigned int b = prev1[i];
+      unsigned int c = prev2[i];
+      prev2[i] = a;
+      if (a == b || a == c) {
+         continue;
+      }
+      // Each bit of the pixel value is the majority of that bit, which gives
+      // the majority value of any pixel where at least two fields agree
+      unsigned int maj = (a & b) | (a & c) | (b & c);
+      unsigned int all = pixel_mask(a ^ b, j->bpp) & pixel_mask(a ^ c, j->bpp) & pixel_mask(b ^ c, j->bpp);
+      unsigned int out = (maj & ~all) | (a & all);
+      if (out != a) {
+         fb[i] = out;
+         if (j->copy) {
+            fb[i + j->pitch] = out;
+         }
+      }
+   }
+}
+
+#ifndef HAS_MULTICORE
+// Fit the filter into what is left of the blanking period after the rest of
+// the end of field work. The latest blanking slack recorded by latency_field()
+// is for the field before last, which had the same field parity.
+static void update_budget() {
+   int slack = latency_get_stats()->blank_slack_us;
+   int used = used_us[field & 1];
+   if (slack == 0) {
+      // Not measured yet
+      return;
+   }
+   if (slack > MAJORITY_OVERRUN_US) {
+      budget_us = used / 2;
+   } else {
+      budget_us = used + slack - MAJORITY_MARGIN_US;
+   }
+   if (budget_us < 0) {
+      budget_us = 0;
+   }
+   if (budget_us > MAJORITY_BUDGET_US) {
+      budget_us = MAJORITY_BUDGET_US;
+   }
+}
+#endif
+
+// =============================================================
+// Public methods
+// =============================================================
+
+void majority_reset(capture_info_t *info) {
+   capinfo = info;
+   job.active = 0;
+#ifdef HAS_MULTICORE
+   job_seq++;
+#endif
+   memset(recorded, 0, sizeof(recorded));
+   memset(run, 0, sizeof(run));
+   field = 0;
+#ifndef HAS_MULTICORE
+   budget_us = MAJORITY_BUDGET_US / 4;
+   used_us[0] = used_us[1] = 0;
+#endif
+   if (capinfo->chars_per_line * capinfo->bpp > MAJORITY_LINE_BYTES || capinfo->nlines > MAJORITY_MAX_LINES) {
+      log_warn("Capture too large for the majority filter");
+   }
+}
+
+void majority_field_start(unsigned char *fb, int flags) {
+   // A field that is not filtered breaks the run of every line
+   field++;
+   job.active = capinfo
+      && (flags & BIT_MAJORITY)
+      && !(flags & (BIT_MODE7 | BIT_PROBE | BIT_CALIBRATE | BIT_INTERLACED))
+      && capinfo->chars_per_line * capinfo->bpp <= MAJORITY_LINE_BYTES
+      && capinfo->nlines <= MAJORITY_MAX_LINES;
+   if (job.active) {
+      job.fb     = (unsigned int *) fb;
+      job.pitch  = capinfo->pitch >> 2;
+      job.words  = (capinfo->chars_per_line * capinfo->bpp) >> 2;
+      job.nlines = capinfo->nlines;
+      job.copy   = !(flags & BIT_SCANLINES);
+      job.bpp    = capinfo->bpp;
+      job.field  = field;
+   }
+#ifndef HAS_MULTICORE
+   if (!job.active) {
+      used_us[field & 1] = 0;
+   }
+#endif
+#ifdef HAS_MULTICORE
+   majority_lines = 0;
+   asm volatile ("dmb" ::: "memory");
+   job_seq++;
+#endif
+}
+
+void majority_field_end() {
+   if (!job.active) {
+      return;
+   }
+   unsigned int start = RPI_GetSystemTimer();
+#ifdef HAS_MULTICORE
+   // Core 1 is normally a line behind
+   while (done_seq != job_seq || done_lines < job.nlines) {
+      if (RPI_GetSystemTimer() - start > MAJORITY_WAIT_US) {
+         // Stop core 1, and wait for it to finish the line in progress, so
+         // it can't write to the field once the OSD has been drawn over it
+         job.active = 0;
+         asm volatile ("dmb" ::: "memory");
+         job_seq++;
+         start = RPI_GetSystemTimer();
+         while (ack_seq != job_seq && RPI_GetSystemTimer() - start <= MAJORITY_WAIT_US) {
+         }
+         break;
+      }
+   }
+#else
+   update_budget();
+   for (int line = 0; line < job.nlines; line++) {
+      if (RPI_GetSystemTimer() - start > budget_us) {
+         break;
+      }
+      filter_line(&job, line);
+   }
+   used_us[field & 1] = RPI_GetSystemTimer() - start;
+#endif
+}
+
+#ifdef HAS_MULTICORE
+void majority_core() {
+   majority_job_t j;
+   unsigned int seq = 0;
+   int line = 0;
+   j.active = 0;
+   while (1) {
+      if (job_seq != seq) {
+         seq = job_seq;
+         asm volatile ("dmb" ::: "memory");
+         memcpy(&j, &job, sizeof(j));
+         line = 0;
+         ack_seq = seq;
+      }
+      if (j.active && line < j.nlines && line < majority_lines) {
+         // Make sure the captured line is seen after the count
+         asm volatile ("dmb" ::: "memory");
+         filter_line(&j, line++);
+         // Make sure the frame buffer writes have completed before reporting progress
+         asm volatile ("dsb" ::: "memory");
+         done_lines = line;
+         done_seq = seq;
+      }
+   }
+}
+#endif
@@ -0,0 +1,45 @@
+// majority.h
+
+#ifndef MAJORITY_H
+#define MAJORITY_H
+
+#include "defs.h"
+
+// Temporal majority filter (Modes 0..6, non-interlaced)
+//
+// Occasional single pixel sampling errors ("sparkle") from a marginal cable
+// or source can't be calibrated out, but on static content they rarely hit
+// the same pixel in consecutive fields. This keeps a copy of the last two
+// captured fields, and replaces each pixel with the majority value of it
+// and the same pixel in those two fields. A pixel that differs in all three
+// fields is passed through unchanged, so motion is not delayed.
+//
+// On the Pi 2/3 the filter runs on core 1, following the capture a line
+// behind, and rgb_to_fb only waits a short time for the last line before
+// stopping it. On the Pi Zero/1 it runs at the end of the field with a time
+// budget, set from the blanking slack measured by the latency code, so only
+// the lines that fit in the blanking period (from the top of the screen),
+// after the rest of the end of field work, are filtered.
+
+// Compact history of the captured lines only (not the frame buffer line doubling)
+#define MAJORITY_MAX_LINES  300
+#define MAJORITY_LINE_BYTES 768
+
+// Forget the history, e.g. after a mode change
+extern void majority_reset(capture_info_t *capinfo);
+
+// Called from rgb_to_fb before the first line of each field, with the draw buffer and the flags register
+extern void majority_field_start(unsigned char *fb, int flags);
+
+// Called from rgb_to_fb after the last line of each field, before the OSD is drawn
+extern void majority_field_end();
+
+#ifdef HAS_MULTICORE
+// Lines captured so far this field, updated by rgb_to_fb on core 0
+extern volatile int majority_lines;
+
+// Runs on core 1, never returns
+extern void majority_core();
+#endif
+
+#endif
@@ -4,10 +4,13 @@
 #include <inttypes.h>
 
 #include "defs.h"
+#include "bootprof.h"
 #include "cpld.h"
+#include "format.h"
 #include "geometry.h"
 #include "gitversion.h"
 #include "info.h"
+#include "latency.h"
 #include "logging.h"
 #include "osd.h"
 #include "rpi-gpio.h"
@@ -16,6 +19,8 @@
 #include "saa5050_font.h"
 #include "rgb_to_fb.h"
 #include "rgb_to_hdmi.h"
+#include "telemetry.h"
+#include "teletext.h"
 
 // =============================================================
 // Definitions for the size of the OSD
@@ -97,13 +102,18 @@ enum {
    F_DEINTERLACE,
    F_PALETTE,
    F_SCANLINES,
+   F_MAJORITY,
    F_ELK,
    F_MUX,
    F_VSYNC,
    F_VLOCKMODE,
    F_VLOCKLINE,
+   F_VLOCKADJ,
+   F_FRACCLOCK,
+   F_FBCACHE,
 #ifdef MULTI_BUFFER
    F_NBUFFERS,
+   F_BEAMRACE,
 #endif
    F_M7DISABLE,
    F_DEBUG
@@ -113,13 +123,18 @@ static param_t features[] = {
    { F_DEINTERLACE,     "Deinterlace", 0, NUM_DEINTERLACES - 1, 1 },
    {     F_PALETTE,         "Palette", 0,     NUM_PALETTES - 1, 1 },
    {   F_SCANLINES,       "Scanlines", 0,                    1, 1 },
+   {    F_MAJORITY, "Majority Filter", 0,                    1, 1 },
    {         F_ELK,             "Elk", 0,                    1, 1 },
    {         F_MUX,       "Input Mux", 0,                    1, 1 },
    {       F_VSYNC, "VSync Indicator", 0,                    1, 1 },
    {   F_VLOCKMODE,      "VLock Mode", 0,                    5, 1 },
    {   F_VLOCKLINE,      "VLock Line", 5,                  265, 1 },
+   {    F_VLOCKADJ,    "VLock Adjust", 0,                    1, 1 },
+   {   F_FRACCLOCK,      "Frac Clock", 0,                    1, 1 },
+   {     F_FBCACHE,        "FB Cache", 0,                    1, 1 },
 #ifdef MULTI_BUFFER
    {    F_NBUFFERS,     "Num Buffers", 0,                    3, 1 },
+   {    F_BEAMRACE,     "Beam Racing", 0,                    1, 1 },
 #endif
    {   F_M7DISABLE,   "Mode7 Disable", 0,                    1, 1 },
    {       F_DEBUG,           "Debug", 0,                    1, 1 },
@@ -174,12 +189,18 @@ typedef struct {
 static void info_cal_summary(int line);
 static void info_cal_detail(int line);
 static void info_cal_raw(int line);
+static void info_mailbox_latency(int line);
+static void info_latency(int line);
+static void info_boot_time(int line);
 static void info_firmware_version(int line);
 static void info_credits(int line);
 
 static info_menu_item_t cal_summary_ref      = { I_INFO, "Calibration Summary", info_cal_summary};
 static info_menu_item_t cal_detail_ref       = { I_INFO, "Calibration Detail",  info_cal_detail};
 static info_menu_item_t cal_raw_ref          = { I_INFO, "Calibration Raw",     info_cal_raw};
+static info_menu_item_t mailbox_latency_ref  = { I_INFO, "Mailbox Latency",     info_mailbox_latency};
+static info_menu_item_t latency_ref          = { I_INFO, "Display Latency",     info_latency};
+static info_menu_item_t boot_time_ref        = { I_INFO, "Boot Time",           info_boot_time};
 static info_menu_item_t firmware_version_ref = { I_INFO, "Firmware Version",    info_firmware_version};
 static info_menu_item_t credits_ref          = { I_INFO, "Credits",             info_credits};
 static back_menu_item_t back_ref             = { I_BACK, "Return"};
@@ -191,6 +212,9 @@ static menu_t info_menu = {
       (base_menu_item_t *) &cal_summary_ref,
       (base_menu_item_t *) &cal_detail_ref,
       (base_menu_item_t *) &cal_raw_ref,
+      (base_menu_item_t *) &mailbox_latency_ref,
+      (base_menu_item_t *) &latency_ref,
+      (base_menu_item_t *) &boot_time_ref,
       (base_menu_item_t *) &firmware_version_ref,
       (base_menu_item_t *) &credits_ref,
       NULL
@@ -200,13 +224,18 @@ static menu_t info_menu = {
 static param_menu_item_t deinterlace_ref = { I_FEATURE, &features[F_DEINTERLACE] };
 static param_menu_item_t palette_ref     = { I_FEATURE, &features[F_PALETTE]     };
 static param_menu_item_t scanlines_ref   = { I_FEATURE, &features[F_SCANLINES]   };
+static param_menu_item_t majority_ref    = { I_FEATURE, &features[F_MAJORITY]    };
 static param_menu_item_t elk_ref         = { I_FEATURE, &features[F_ELK]         };
 static param_menu_item_t mux_ref         = { I_FEATURE, &features[F_MUX]         };
 static param_menu_item_t vsync_ref       = { I_FEATURE, &features[F_VSYNC]       };
 static param_menu_item_t vlockmode_ref   = { I_FEATURE, &features[F_VLOCKMODE]   };
 static param_menu_item_t vlockline_ref   = { I_FEATURE, &features[F_VLOCKLINE]   };
+static param_menu_item_t vlockadj_ref    = { I_FEATURE, &features[F_VLOCKADJ]    };
+static param_menu_item_t fracclock_ref   = { I_FEATURE, &features[F_FRACCLOCK]   };
+static param_menu_item_t fbcache_ref     = { I_FEATURE, &features[F_FBCACHE]     };
 #ifdef MULTI_BUFFER
 static param_menu_item_t nbuffers_ref    = { I_FEATURE, &features[F_NBUFFERS]    };
+static param_menu_item_t beamrace_ref    = { I_FEATURE, &features[F_BEAMRACE]    };
 #endif
 static param_menu_item_t m7disable_ref   = { I_FEATURE, &features[F_M7DISABLE]   };
 static param_menu_item_t debug_ref       = { I_FEATURE, &features[F_DEBUG]       };
@@ -218,6 +247,7 @@ static menu_t processing_menu = {
       (base_menu_item_t *) &deinterlace_ref,
       (base_menu_item_t *) &palette_ref,
       (base_menu_item_t *) &scanlines_ref,
+      (base_menu_item_t *) &majority_ref,
       NULL
    }
 };
@@ -231,7 +261,11 @@ static menu_t settings_menu = {
       (base_menu_item_t *) &vsync_ref,
       (base_menu_item_t *) &vlockmode_ref,
       (base_menu_item_t *) &vlockline_ref,
+      (base_menu_item_t *) &vlockadj_ref,
+      (base_menu_item_t *) &fracclock_ref,
+      (base_menu_item_t *) &fbcache_ref,
       (base_menu_item_t *) &nbuffers_ref,
+      (base_menu_item_t *) &beamrace_ref,
       (base_menu_item_t *) &debug_ref,
       (base_menu_item_t *) &m7disable_ref,
       NULL
@@ -365,6 +399,9 @@ static char message[80];
 // Is the OSD currently active
 static int active = 0;
 
+// Have the mapping tables been built
+static int tables_built = 0;
+
 // Main state of the OSD
 osd_state_t osd_state;
 
@@ -407,6 +444,8 @@ static int get_feature(int num) {
       return palette;
    case F_SCANLINES:
       return get_scanlines();
+   case F_MAJORITY:
+      return get_majority();
    case F_ELK:
       return get_elk();
    case F_MUX:
@@ -417,9 +456,17 @@ static int get_feature(int num) {
       return get_vlockmode();
    case F_VLOCKLINE:
       return get_vlockline();
+   case F_VLOCKADJ:
+      return get_vlockadj();
+   case F_FRACCLOCK:
+      return get_fracclock();
+   case F_FBCACHE:
+      return get_fbcache();
 #ifdef MULTI_BUFFER
    case F_NBUFFERS:
       return get_nbuffers();
+   case F_BEAMRACE:
+      return get_beamrace();
 #endif
    case F_M7DISABLE:
       return get_m7disable();
@@ -441,6 +488,9 @@ static void set_feature(int num, int value) {
    case F_SCANLINES:
       set_scanlines(value);
       break;
+   case F_MAJORITY:
+      set_majority(value);
+      break;
    case F_ELK:
       set_elk(value);
       break;
@@ -457,10 +507,22 @@ static void set_feature(int num, int value) {
    case F_VLOCKLINE:
       set_vlockline(value);
       break;
+   case F_VLOCKADJ:
+      set_vlockadj(value);
+      break;
+   case F_FRACCLOCK:
+      set_fracclock(value);
+      break;
+   case F_FBCACHE:
+      set_fbcache(value);
+      break;
 #ifdef MULTI_BUFFER
    case F_NBUFFERS:
       set_nbuffers(value);
       break;
+   case F_BEAMRACE:
+      set_beamrace(value);
+      break;
 #endif
    case F_DEBUG:
       set_debug(value);
@@ -553,14 +615,14 @@ static const char *get_param_string(param_menu_item_t *param_item) {
    if (is_boolean_param(param_item)) {
       return value ? "On" : "Off";
    }
-   sprintf(number, "%d", value);
+   format_sprintf(number, "%d", value);
    return number;
 }
 
 static void info_firmware_version(int line) {
-   sprintf(message, "Pi Firmware: %s", GITVERSION);
+   format_sprintf(message, "Pi Firmware: %s", GITVERSION);
    osd_set(line, 0, message);
-   sprintf(message, "%s CPLD: v%x.%x",
+   format_sprintf(message, "%s CPLD: v%x.%x",
            cpld->name,
            (cpld->get_version() >> VERSION_MAJOR_BIT) & 0xF,
            (cpld->get_version() >> VERSION_MINOR_BIT) & 0xF);
@@ -582,17 +644,22 @@ static void info_credits(int line) {
 static void info_cal_summary(int line) {
    const char *machine = get_elk() ? "Elk" : "Beeb";
    if (clock_error_ppm > 0) {
-      sprintf(message, "Clk Err: %d ppm (%s slower than Pi)", clock_error_ppm, machine);
+      format_sprintf(message, "Clk Err: %d ppm (%s slower than Pi)", clock_error_ppm, machine);
    } else if (clock_error_ppm < 0) {
-      sprintf(message, "Clk Err: %d ppm (%s faster than Pi)", -clock_error_ppm, machine);
+      format_sprintf(message, "Clk Err: %d ppm (%s faster than Pi)", -clock_error_ppm, machine);
    } else {
-      sprintf(message, "Clk Err: %d ppm (exact match)", clock_error_ppm);
+      format_sprintf(message, "Clk Err: %d ppm (exact match)", clock_error_ppm);
    }
    osd_set(line, 0, message);
+   if (clock_drift_ppm) {
+      line++;
+      format_sprintf(message, "Drift: %d ppm since calibration", clock_drift_ppm);
+      osd_set(line, 0, message);
+   }
    if (cpld->show_cal_summary) {
       cpld->show_cal_summary(line + 2);
    } else {
-      sprintf(message, "show_cal_summary() not implemented");
+      format_sprintf(message, "show_cal_summary() not implemented");
       osd_set(line + 2, 0, message);
    }
 }
@@ -601,7 +668,7 @@ static void info_cal_detail(int line) {
    if (cpld->show_cal_details) {
       cpld->show_cal_details(line);
    } else {
-      sprintf(message, "show_cal_details() not implemented");
+      format_sprintf(message, "show_cal_details() not implemented");
       osd_set(line, 0, message);
    }
 }
@@ -610,11 +677,188 @@ static void info_cal_raw(int line) {
    if (cpld->show_cal_raw) {
       cpld->show_cal_raw(line);
    } else {
-      sprintf(message, "show_cal_raw() not implemented");
+      format_sprintf(message, "show_cal_raw() not implemented");
       osd_set(line, 0, message);
    }
 }
 
+static void info_mailbox_latency(int line) {
+   static const char *units[] = { "K", "M" };
+   const unsigned int *histogram = RPI_PropertyLatencyHistogram();
+   const prop_latency_stats_t *stats;
+   char *mp = message;
+   int mhz = get_clock_rate(ARM_CLK_ID) / 1000000;
+   int i;
+   osd_set(line++, 0, "Latency histogram (ARM cycles):");
+   for (i = 0; i < PROP_LATENCY_BUCKETS; i++) {
+      char label[8];
+      int limit = 1 << i;
+      if (i == PROP_LATENCY_BUCKETS - 1) {
+         format_sprintf(label, ">=%d%s", limit >> 11, units[1]);
+      } else {
+         format_sprintf(label, "<%d%s", limit >= 1024 ? limit >> 10 : limit, units[limit >= 1024]);
+      }
+      mp += format_sprintf(mp, "%5s:%-7u", label, histogram[i]);
+      if ((i % 3) == 2 || i == PROP_LATENCY_BUCKETS - 1) {
+         osd_set(line++, 0, message);
+         mp = message;
+      }
+   }
+   line++;
+   osd_set(line++, 0, "Tag      Count   Mean(us)  Max(us)");
+   for (i = 0; line < NLINES && (stats = RPI_PropertyLatencyStats(i)); i++) {
+      format_sprintf(message, "%05x %8u %10u %8u", stats->tag, stats->count,
+              (unsigned int) (stats->total / stats->count) / mhz, stats->max / mhz);
+      osd_set(line++, 0, message);
+   }
+}
+
+static void info_latency(int line) {
+   const latency_stats_t *stats = latency_get_stats();
+   osd_set(line++, 0, "Capture to display latency (us):");
+   if (stats->count == 0) {
+      osd_set(line++, 0, "No fields measured");
+   } else {
+      format_sprintf(message, "   Min %6u   Mean %6u   Max %6u", stats->min_us,
+                     (unsigned int) (stats->total_us / stats->count), stats->max_us);
+      osd_set(line++, 0, message);
+      format_sprintf(message, "  Last %6u", stats->last_us);
+      osd_set(line++, 0, message);
+      osd_set(line++, 0, "Mean of each stage (us):");
+      format_sprintf(message, "   Capture   %6u", (unsigned int) (stats->capture_us / stats->count));
+      osd_set(line++, 0, message);
+      format_sprintf(message, "   Flip wait %6u", (unsigned int) (stats->flip_us / stats->count));
+      osd_set(line++, 0, message);
+      format_sprintf(message, "   Scanout   %6u", (unsigned int) (stats->scanout_us / stats->count));
+      osd_set(line++, 0, message);
+   }
+   format_sprintf(message, "Fields measured: %u, missed: %u", stats->count, stats->missed);
+   osd_set(line++, 0, message);
+   line++;
+   format_sprintf(message, "Slack (%s framebuffer):", get_fbcache() ? "cached" : "uncached");
+   osd_set(line++, 0, message);
+   format_sprintf(message, "   Line  (ns) Last %6u   Min %6u", stats->line_slack_ns, stats->line_slack_min_ns);
+   osd_set(line++, 0, message);
+   format_sprintf(message, "   Blank (us) Last %6u   Min %6u", stats->blank_slack_us, stats->blank_slack_min_us);
+   osd_set(line++, 0, message);
+   line++;
+   osd_set(line++, 0, "From source vsync to 1st HDMI line");
+}
+
+static void info_boot_time(int line) {
+   const bootprof_phase_t *phase;
+   uint32_t last = 0;
+   osd_set(line++, 0, "Phase                Time(ms)  Delta(ms)");
+   for (int i = 0; line < NLINES && (phase = bootprof_get_phase(i)); i++) {
+      format_sprintf(message, "%-20s %8u %10u", phase->name, (unsigned int) phase->time / 1000,
+                     (unsigned int) (phase->time - last) / 1000);
+      osd_set(line++, 0, message);
+      last = phase->time;
+   }
+}
+
+// The character mapping tables are ~250KB, so they are built the first time
+// the OSD is used, rather than at boot
+static void init_tables() {
+   // Precalculate character->screen mapping table
+   //
+   // Normal size mapping, odd numbered characters
+   //
+   // char bit  0 -> double_size_map + 2 bit 31
+   // ...
+   // char bit  7 -> double_size_map + 2 bit  3
+   // char bit  8 -> double_size_map + 1 bit 31
+   // ...
+   // char bit 11 -> double_size_map + 1 bit 19
+   //
+   // Normal size mapping, even numbered characters
+   //
+   // char bit  0 -> double_size_map + 1 bit 15
+   // ...
+   // char bit  3 -> double_size_map + 1 bit  3
+   // char bit  4 -> double_size_map + 0 bit 31
+   // ...
+   // char bit 11 -> double_size_map + 0 bit  3
+   //
+   // Double size mapping
+   //
+   // char bit  0 -> double_size_map + 2 bits 31, 27
+   // ...
+   // char bit  3 -> double_size_map + 2 bits  7,  3
+   // char bit  4 -> double_size_map + 1 bits 31, 27
+   // ...
+   // char bit  7 -> double_size_map + 1 bits  7,  3
+   // char bit  8 -> double_size_map + 0 bits 31, 27
+   // ...
+   // char bit 11 -> double_size_map + 0 bits  7,  3
+   memset(normal_size_map_4bpp, 0, sizeof(normal_size_map_4bpp));
+   memset(double_size_map_4bpp, 0, sizeof(double_size_map_4bpp));
+   memset(normal_size_map_8bpp, 0, sizeof(normal_size_map_8bpp));
+   memset(double_size_map_8bpp, 0, sizeof(double_size_map_8bpp));
+   for (int i = 0; i <= 0xFFF; i++) {
+      for (int j = 0; j < 12; j++) {
+         // j is the pixel font data bit, with bit 11 being left most
+         if (i & (1 << j)) {
+
+            // ======= 4 bits/pixel tables ======
+
+            // Normal size, odd characters
+            // cccc.... dddddddd
+            if (j < 8) {
+               normal_size_map_4bpp[i * 4 + 3] |= 0x8 << (4 * (7 - (j ^ 1)));   // dddddddd
+            } else {
+                  normal_size_map_4bpp[i * 4 + 2] |= 0x8 << (4 * (15 - (j ^ 1)));  // cccc....
+            }
+            // Normal size, even characters
+            // aaaaaaaa ....bbbb
+            if (j < 4) {
+               normal_size_map_4bpp[i * 4 + 1] |= 0x8 << (4 * (3 - (j ^ 1)));   // ....bbbb
+            } else {
+               normal_size_map_4bpp[i * 4    ] |= 0x8 << (4 * (11 - (j ^ 1)));  // aaaaaaaa
+            }
+            // Double size
+            // aaaaaaaa bbbbbbbb cccccccc
+            if (j < 4) {
+               double_size_map_4bpp[i * 3 + 2] |= 0x88 << (8 * (3 - j));  // cccccccc
+            } else if (j < 8) {
+               double_size_map_4bpp[i * 3 + 1] |= 0x88 << (8 * (7 - j));  // bbbbbbbb
+            } else {
+               double_size_map_4bpp[i * 3    ] |= 0x88 << (8 * (11 - j)); // aaaaaaaa
+            }
+
+            // ======= 8 bits/pixel tables ======
+
+            // Normal size
+            // aaaaaaaa bbbbbbbb cccccccc
+            if (j < 4) {
+               normal_size_map_8bpp[i * 3 + 2] |= 0x80 << (8 * (3 - j));  // cccccccc
+            } else if (j < 8) {
+               normal_size_map_8bpp[i * 3 + 1] |= 0x80 << (8 * (7 - j));  // bbbbbbbb
+            } else {
+               normal_size_map_8bpp[i * 3    ] |= 0x80 << (8 * (11 - j)); // aaaaaaaa
+            }
+
+            // Double size
+            // aaaaaaaa bbbbbbbb cccccccc dddddddd eeeeeeee ffffffff
+            if (j < 2) {
+               double_size_map_8bpp[i * 6 + 5] |= 0x8080 << (16 * (1 - j));  // ffffffff
+            } else if (j < 4) {
+               double_size_map_8bpp[i * 6 + 4] |= 0x8080 << (16 * (3 - j));  // eeeeeeee
+            } else if (j < 6) {
+               double_size_map_8bpp[i * 6 + 3] |= 0x8080 << (16 * (5 - j));  // dddddddd
+            } else if (j < 8) {
+               double_size_map_8bpp[i * 6 + 2] |= 0x8080 << (16 * (7 - j));  // cccccccc
+            } else if (j < 10) {
+               double_size_map_8bpp[i * 6 + 1] |= 0x8080 << (16 * (9 - j));  // bbbbbbbb
+            } else {
+               double_size_map_8bpp[i * 6    ] |= 0x8080 << (16 * (11 - j)); // aaaaaaaa
+            }
+         }
+      }
+   }
+   tables_built = 1;
+}
+
 static void rebuild_menu(menu_t *menu, item_type_t type, param_t *param_ptr) {
    int i = 0;
    if (!return_at_end) {
@@ -870,11 +1114,8 @@ void osd_update_palette() {
       }
    }
 
-   // Flush the previous swapBuffer() response from the GPU->ARM mailbox
-   RPI_Mailbox0Flush( MB0_TAGS_ARM_TO_VC  );
-   RPI_PropertyInit();
-   RPI_PropertyAddTag(TAG_SET_PALETTE, num_colours, palette_data);
-   RPI_PropertyProcess();
+   // Batch the palette update with the other requests for this field
+   RPI_PropertyBatchAddTag(TAG_SET_PALETTE, num_colours, palette_data);
 }
 
 void osd_clear() {
@@ -888,6 +1129,9 @@ void osd_clear() {
 
 void osd_set(int line, int attr, char *text) {
    if (!active) {
+      if (!tables_built) {
+         init_tables();
+      }
       active = 1;
       osd_update_palette();
    }
@@ -922,6 +1166,8 @@ int osd_key(int key) {
    static int cal_count;
    static int last_vsync;
 
+   telemetry_event(TM_KEY, key, 0);
+
    switch (osd_state) {
 
    case IDLE:
@@ -1092,105 +1338,9 @@ int osd_key(int key) {
 
 void osd_init() {
    char *prop;
-   // Precalculate character->screen mapping table
-   //
-   // Normal size mapping, odd numbered characters
-   //
-   // char bit  0 -> double_size_map + 2 bit 31
-   // ...
-   // char bit  7 -> double_size_map + 2 bit  3
-   // char bit  8 -> double_size_map + 1 bit 31
-   // ...
-   // char bit 11 -> double_size_map + 1 bit 19
-   //
-   // Normal size mapping, even numbered characters
-   //
-   // char bit  0 -> double_size_map + 1 bit 15
-   // ...
-   // char bit  3 -> double_size_map + 1 bit  3
-   // char bit  4 -> double_size_map + 0 bit 31
-   // ...
-   // char bit 11 -> double_size_map + 0 bit  3
-   //
-   // Double size mapping
-   //
-   // char bit  0 -> double_size_map + 2 bits 31, 27
-   // ...
-   // char bit  3 -> double_size_map + 2 bits  7,  3
-   // char bit  4 -> double_size_map + 1 bits 31, 27
-   // ...
-   // char bit  7 -> double_size_map + 1 bits  7,  3
-   // char bit  8 -> double_size_map + 0 bits 31, 27
-   // ...
-   // char bit 11 -> double_size_map + 0 bits  7,  3
-   memset(normal_size_map_4bpp, 0, sizeof(normal_size_map_4bpp));
-   memset(double_size_map_4bpp, 0, sizeof(double_size_map_4bpp));
-   memset(normal_size_map_8bpp, 0, sizeof(normal_size_map_8bpp));
-   memset(double_size_map_8bpp, 0, sizeof(double_size_map_8bpp));
    for (int i = 0; i < NLINES; i++) {
       attributes[i] = 0;
    }
-   for (int i = 0; i <= 0xFFF; i++) {
-      for (int j = 0; j < 12; j++) {
-         // j is the pixel font data bit, with bit 11 being left most
-         if (i & (1 << j)) {
-
-            // ======= 4 bits/pixel tables ======
-
-            // Normal size, odd characters
-            // cccc.... dddddddd
-            if (j < 8) {
-               normal_size_map_4bpp[i * 4 + 3] |= 0x8 << (4 * (7 - (j ^ 1)));   // dddddddd
-            } else {
-                  normal_size_map_4bpp[i * 4 + 2] |= 0x8 << (4 * (15 - (j ^ 1)));  // cccc....
-            }
-            // Normal size, even characters
-            // aaaaaaaa ....bbbb
-            if (j < 4) {
-               normal_size_map_4bpp[i * 4 + 1] |= 0x8 << (4 * (3 - (j ^ 1)));   // ....bbbb
-            } else {
-               normal_size_map_4bpp[i * 4    ] |= 0x8 << (4 * (11 - (j ^ 1)));  // aaaaaaaa
-            }
-            // Double size
-            // aaaaaaaa bbbbbbbb cccccccc
-            if (j < 4) {
-               double_size_map_4bpp[i * 3 + 2] |= 0x88 << (8 * (3 - j));  // cccccccc
-            } else if (j < 8) {
-               double_size_map_4bpp[i * 3 + 1] |= 0x88 << (8 * (7 - j));  // bbbbbbbb
-            } else {
-               double_size_map_4bpp[i * 3    ] |= 0x88 << (8 * (11 - j)); // aaaaaaaa
-            }
-
-            // ======= 8 bits/pixel tables ======
-
-            // Normal size
-            // aaaaaaaa bbbbbbbb cccccccc
-            if (j < 4) {
-               normal_size_map_8bpp[i * 3 + 2] |= 0x80 << (8 * (3 - j));  // cccccccc
-            } else if (j < 8) {
-               normal_size_map_8bpp[i * 3 + 1] |= 0x80 << (8 * (7 - j));  // bbbbbbbb
-            } else {
-               normal_size_map_8bpp[i * 3    ] |= 0x80 << (8 * (11 - j)); // aaaaaaaa
-            }
-
-            // Double size
-            // aaaaaaaa bbbbbbbb cccccccc dddddddd eeeeeeee ffffffff
-            if (j < 2) {
-               double_size_map_8bpp[i * 6 + 5] |= 0x8080 << (16 * (1 - j));  // ffffffff
-            } else if (j < 4) {
-               double_size_map_8bpp[i * 6 + 4] |= 0x8080 << (16 * (3 - j));  // eeeeeeee
-            } else if (j < 6) {
-               double_size_map_8bpp[i * 6 + 3] |= 0x8080 << (16 * (5 - j));  // dddddddd
-            } else if (j < 8) {
-               double_size_map_8bpp[i * 6 + 2] |= 0x8080 << (16 * (7 - j));  // cccccccc
-            } else if (j < 10) {
-               double_size_map_8bpp[i * 6 + 1] |= 0x8080 << (16 * (9 - j));  // bbbbbbbb
-            } else {
-               double_size_map_8bpp[i * 6    ] |= 0x8080 << (16 * (11 - j)); // aaaaaaaa
-            }
-         }
-      }
-   }
    // Initialize the OSD features
    prop = get_cmdline_prop("deinterlace");
    if (prop) {
@@ -1210,6 +1360,12 @@ void osd_init() {
       set_feature(F_SCANLINES, val);
       log_info("config.txt:   scanlines = %d", val);
    }
+   prop = get_cmdline_prop("majority");
+   if (prop) {
+      int val = atoi(prop);
+      set_feature(F_MAJORITY, val);
+      log_info("config.txt:    majority = %d", val);
+   }
    prop = get_cmdline_prop("elk");
    if (prop) {
       int val = atoi(prop);
@@ -1240,6 +1396,24 @@ void osd_init() {
       set_feature(F_VLOCKLINE, val);
       log_info("config.txt:   vlockline = %d", val);
    }
+   prop = get_cmdline_prop("vlockadj");
+   if (prop) {
+      int val = atoi(prop);
+      set_feature(F_VLOCKADJ, val);
+      log_info("config.txt:    vlockadj = %d", val);
+   }
+   prop = get_cmdline_prop("fracclock");
+   if (prop) {
+      int val = atoi(prop);
+      set_feature(F_FRACCLOCK, val);
+      log_info("config.txt:   fracclock = %d", val);
+   }
+   prop = get_cmdline_prop("fbcache");
+   if (prop) {
+      int val = atoi(prop);
+      set_feature(F_FBCACHE, val);
+      log_info("config.txt:     fbcache = %d", val);
+   }
 #ifdef MULTI_BUFFER
    prop = get_cmdline_prop("nbuffers");
    if (prop) {
@@ -1247,6 +1421,12 @@ void osd_init() {
       set_feature(F_NBUFFERS, val);
       log_info("config.txt:    nbuffers = %d", val);
    }
+   prop = get_cmdline_prop("beamrace");
+   if (prop) {
+      int val = atoi(prop);
+      set_feature(F_BEAMRACE, val);
+      log_info("config.txt:    beamrace = %d", val);
+   }
 #endif
    prop = get_cmdline_prop("debug");
    if (prop) {
@@ -1254,6 +1434,18 @@ void osd_init() {
       set_feature(F_DEBUG, val);
       log_info("config.txt:       debug = %d", val);
    }
+   prop = get_cmdline_prop("telemetry");
+   if (prop) {
+      int val = atoi(prop);
+      log_info("config.txt:   telemetry = %d", val);
+      telemetry_enable(val);
+   }
+   prop = get_cmdline_prop("teletext");
+   if (prop) {
+      int val = atoi(prop);
+      log_info("config.txt:    teletext = %d", val);
+      teletext_enable(val);
+   }
    prop = get_cmdline_prop("m7disable");
    if (prop) {
       int val = atoi(prop);
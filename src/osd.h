@@ -10,6 +10,8 @@
 
 extern int clock_error_ppm;
 
+extern int clock_drift_ppm;
+
 enum {
    HDMI_ORIGINAL,
    HDMI_SLOW_2000PPM,
@@ -31,6 +31,18 @@ extern int capture_line_default_4bpp_double();
 
 extern int capture_line_default_8bpp();
 
+extern int capture_line_default_4bpp_burst();
+
+extern int capture_line_default_8bpp_burst();
+
+extern int capture_line_default_4bpp_scanlines();
+
+extern int capture_line_default_8bpp_scanlines();
+
+extern int capture_line_default_4bpp_ma();
+
+extern int capture_line_default_8bpp_ma();
+
 extern int capture_line_mode7_4bpp();
 
 extern int vsync_line;
@@ -39,6 +51,38 @@ extern int default_vsync_line;
 
 extern int lock_fail;
 
+extern unsigned int capture_start_time;
+
+extern unsigned int capture_end_time;
+
+extern unsigned int vsync_time;
+
+extern int vsync_count;
+
+extern unsigned int hsync_first_time;
+
+extern unsigned int hsync_last_time;
+
+extern unsigned int line_slack_min;
+
+extern int compare_offset;
+
+extern int motion_line;
+
+extern unsigned int blank_end_time;
+
 int recalculate_hdmi_clock_line_locked_update();
 
+void fb_clean_field(unsigned char *fb);
+
+extern int fb_cached;
+
+void fb_clear_request(capture_info_t *capinfo, int flags);
+
+void fb_clear_step(int flags);
+
+extern unsigned char *compare_base;
+
+extern unsigned int motion_bitmap[];
+
 #endif
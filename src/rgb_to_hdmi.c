@@ -4,6 +4,7 @@
 #include <inttypes.h>
 #include <limits.h>
 #include <math.h>
+#include "bootprof.h"
 #include "cache.h"
 #include "defs.h"
 #include "cpld.h"
@@ -13,6 +14,7 @@
 #include "rpi-gpio.h"
 #include "rpi-interrupts.h"
 #include "rpi-mailbox-interface.h"
+#include "rpi-systimer.h"
 #include "startup.h"
 #include "rpi-mailbox.h"
 #include "osd.h"
@@ -20,23 +22,50 @@
 #include "cpld_normal.h"
 #include "cpld_atom.h"
 #include "geometry.h"
+#include "genlock.h"
+#include "latency.h"
+#include "majority.h"
 #include "rgb_to_fb.h"
+#include "telemetry.h"
+#include "teletext.h"
 
 // #define INSTRUMENT_CAL
 #define NUM_CAL_PASSES 1
 
+// How long to wait for a secondary core to start
+#define CORE_START_TIMEOUT_US 100000
+
+// Calibration cache
+#define CAL_CACHE_SIZE 8
+#define CAL_BUCKET_NS  250     // line period bucket size
+#define CAL_CACHE_PPM  100     // maximum line period difference for a cache hit
+
+// Drift tracking
+#define DRIFT_FILTER    64     // time constant of the line period filter, in fields
+#define DRIFT_STEP_PPM   2     // minimum change in drift before a correction is applied
+#define DRIFT_MAX_PPM 1000     // line periods further than this from calibration are ignored
+
 typedef void (*func_ptr)();
 
 #define GZ_CLK_BUSY    (1 << 7)
 #define GP_CLK1_CTL (volatile uint32_t *)(PERIPHERAL_BASE + 0x101078)
 #define GP_CLK1_DIV (volatile uint32_t *)(PERIPHERAL_BASE + 0x10107C)
 
+// Beam racing: the HDMI vsync is genlocked to occur BEAM_RACE_LAG lines into
+// the capture, and single buffering is used once the measured lag has been at
+// least BEAM_RACE_MIN_LAG lines for BEAM_RACE_SETTLE consecutive fields
+#define BEAM_RACE_LAG      16
+#define BEAM_RACE_MIN_LAG   8
+#define BEAM_RACE_SETTLE   25
+
+// Time budget for each call to fb_clear_step, in the blanking period
+#define FB_CLEAR_BUDGET_US 500
 
-#define PIXELVALVE2_BASE  (volatile uint32_t *)(PERIPHERAL_BASE + 0x807000)
-#define PIXELVALVE2_HORZA (volatile uint32_t *)(PERIPHERAL_BASE + 0x80700c)
-#define PIXELVALVE2_HORZB (volatile uint32_t *)(PERIPHERAL_BASE + 0x807010)
-#define PIXELVALVE2_VERTA (volatile uint32_t *)(PERIPHERAL_BASE + 0x807014)
-#define PIXELVALVE2_VERTB (volatile uint32_t *)(PERIPHERAL_BASE + 0x807018)
+#ifdef MULTI_BUFFER
+#define FB_CLEAR_BUFFERS NBUFFERS
+#else
+#define FB_CLEAR_BUFFERS 1
+#endif
 
 // =============================================================
 // Forward declarations
@@ -50,6 +79,7 @@ static void cpld_init();
 
 cpld_t *cpld = NULL;
 int clock_error_ppm = 0;
+int clock_drift_ppm = 0;
 int vsync_time_ns = 0;
 capture_info_t *capinfo;
 clk_info_t clkinfo;
@@ -64,11 +94,60 @@ static uint32_t cpld_version_id;
 static int mode7;
 static int interlaced;
 static int clear;
+static int recalibrate;
 static volatile int delay;
-static double pllh_clock = 0;
-static int genlocked = 0;
-static int resync_count = 0;
-static int target_difference = 0;
+#ifdef MULTI_BUFFER
+static int beam_race_count = 0;
+#endif
+
+// The framebuffer currently allocated by the GPU
+static int fb_alloc_width  = 0;
+static int fb_alloc_height = 0;
+static int fb_alloc_bpp    = 0;
+static int fb_alloc_pitch  = 0;
+static unsigned char *fb_alloc_fb = NULL;
+int fb_cached = 0;               // the framebuffer is currently mapped L2 cached
+static int fb_clean_all = 0;     // clean all the buffers at the end of the next field
+
+// The screen clear requested by BIT_CLEAR, and the scan line dark line clear,
+// done a few lines at a time by fb_clear_step()
+static unsigned char *clear_fb = NULL;
+static int clear_pitch         = 0;
+static int clear_height        = 0;
+static int clear_width         = 0;  // displayed bytes per line
+static int clear_active_lines  = 0;  // lines rewritten by the capture every field
+static int clear_active_bytes  = 0;  // bytes of those lines rewritten by the capture
+static int clear_dark          = 0;  // the odd active lines are not rewritten, so are cleared in full
+static int clear_line[FB_CLEAR_BUFFERS];  // next line to clear in each buffer (clear_height when done)
+static int dark_line[FB_CLEAR_BUFFERS];   // next dark line to zero in each buffer (0 when done)
+
+// Results of calibrate_sampling_clock(), cached by source timing signature
+typedef struct {
+   int valid;
+   // The key, which only uses what is known before measuring
+   int mode7;
+   int line_bucket;         // line period in units of CAL_BUCKET_NS
+   clk_info_t clkinfo;      // the configuration these results are for
+   // The results
+   int nlines_time_ns;      // the initial measurement, to validate against
+   int core_clock;
+   int gpclk_divisor;
+   int gpclk_fraction;
+   int vsync_time_ns;
+   int clock_error_ppm;
+   int interlaced;
+} calibration_t;
+
+static calibration_t calibration_cache[CAL_CACHE_SIZE];
+static int calibration_next = 0;
+static int calibration_refresh = 0;  // measure again even on a cache hit
+static int core_clock = 0;
+
+// Drift of the source line period since calibration
+static double drift_ref_line_ns = 0;    // line period at calibration
+static double drift_line_ns = 0;        // filtered line period
+static double drift_divisor = 0;        // GPCLK divisor at calibration, or 0 if not fractional
+static double drift_applied_ppm = 0;
 
 // =============================================================
 // OSD parameters
@@ -78,22 +157,33 @@ static int elk         = 0;
 static int debug       = 0;
 static int m7disable   = 0;
 static int scanlines   = 0;
+static int majority    = 0;
 static int deinterlace = 0;
 static int vsync       = 0;
 static int vlockmode   = 0;
 static int vlockline   = 5;
+static int vlockadj    = 0;
+static int fracclock   = 0;
+static int fbcache     = 0;
 #ifdef MULTI_BUFFER
 static int nbuffers    = 2;
+static int beamrace    = 0;
 #endif
 
-static int current_vlockmode = -1;
-
-// Calculated so that the constants from librpitx work
-static volatile uint32_t *gpioreg = (volatile uint32_t *)(PERIPHERAL_BASE + 0x101000UL);
-
 // Temporary buffer that must be at least as large as a frame buffer
 static unsigned char last[2048 * 1024] __attribute__((aligned(32)));
 
+// Previous field values for the deinterlace, kept in cached memory rather
+// than in the (uncached) frame buffer
+static unsigned char compare_buffer[COMPARE_BUFFER_SIZE] __attribute__((aligned(64)));
+
+// The comparison buffer in use, rgb_to_fb makes this relative to each draw buffer
+unsigned char *compare_base;
+static int compare_fallback = 0;  // compare_base is the second frame buffer
+
+// Motion history for the Mode 0..6 deinterlace
+unsigned int motion_bitmap[MOTION_BITMAP_SIZE / 4] __attribute__((aligned(64)));
+
 #ifndef USE_PROPERTY_INTERFACE_FOR_FB
 typedef struct {
    uint32_t width;
@@ -131,7 +221,9 @@ static framebuf *fbp = (framebuf *) (UNCACHED_MEM_BASE + 0x10000);
 // Source 5 = PLLC = core_freq * 3
 // Source 6 = PLLD = 500MHz
 
-static void init_gpclk(int source, int divisor) {
+// A non-zero fraction (in 1/4096ths) needs mash > 0, which dithers the
+// divisor between divisor and divisor + 1
+static void init_gpclk(int source, int divisor, int fraction, int mash) {
    log_debug("A GP_CLK1_DIV = %08"PRIx32, *GP_CLK1_DIV);
 
    log_debug("B GP_CLK1_CTL = %08"PRIx32, *GP_CLK1_CTL);
@@ -145,13 +237,13 @@ static void init_gpclk(int source, int divisor) {
    log_debug("D GP_CLK1_CTL = %08"PRIx32, *GP_CLK1_CTL);
 
    // Configure the clock generator
-   *GP_CLK1_DIV = 0x5A000000 | (divisor << 12);
-   *GP_CLK1_CTL = 0x5A000000 | source;
+   *GP_CLK1_DIV = 0x5A000000 | (divisor << GPCLK_FRACTION_BITS) | fraction;
+   *GP_CLK1_CTL = 0x5A000000 | (mash << 9) | source;
 
    log_debug("E GP_CLK1_CTL = %08"PRIx32, *GP_CLK1_CTL);
 
    // Start the clock generator
-   *GP_CLK1_CTL = 0x5A000010 | source;
+   *GP_CLK1_CTL = 0x5A000010 | (mash << 9) | source;
 
    log_debug("F GP_CLK1_CTL = %08"PRIx32, *GP_CLK1_CTL);
    while (!((*GP_CLK1_CTL) & GZ_CLK_BUSY)) {}    // Wait for BUSY high
@@ -160,6 +252,17 @@ static void init_gpclk(int source, int divisor) {
    log_debug("H GP_CLK1_DIV = %08"PRIx32, *GP_CLK1_DIV);
 }
 
+// Change the divisor of the running clock generator, which needs MASH enabled
+static void set_gpclk_divisor(double divisor) {
+   int divi = (int) divisor;
+   int divf = (int) ((divisor - (double) divi) * (double) (1 << GPCLK_FRACTION_BITS) + 0.5);
+   if (divf == (1 << GPCLK_FRACTION_BITS)) {
+      divi++;
+      divf = 0;
+   }
+   *GP_CLK1_DIV = 0x5A000000 | (divi << GPCLK_FRACTION_BITS) | divf;
+}
+
 #ifdef USE_PROPERTY_INTERFACE_FOR_FB
 
 static void init_framebuffer(capture_info_t *capinfo) {
@@ -275,10 +378,277 @@ static void init_framebuffer(capture_info_t *capinfo) {
 
 #endif
 
-static int calibrate_sampling_clock() {
+// Size of the allocated framebuffer, including all the buffers
+static unsigned int fb_alloc_size() {
+#ifdef MULTI_BUFFER
+   return fb_alloc_pitch * fb_alloc_height * NBUFFERS;
+#else
+   return fb_alloc_pitch * fb_alloc_height;
+#endif
+}
+
+// Map the framebuffer L2 cached (write back) or uncached
+//
+// When cached, the capture and OSD writes (and the deinterlace reads) are
+// much cheaper, but the drawn buffer must be cleaned to memory before it is
+// displayed, which rgb_to_fb does with fb_clean_field() at the end of each field.
+static void map_framebuffer(int cached) {
+   if (fb_alloc_fb && cached != fb_cached) {
+      map_l2_cached(fb_alloc_fb, fb_alloc_size(), cached);
+      fb_cached = cached;
+      log_info("Framebuffer is %s", cached ? "L2 cached" : "uncached");
+   }
+}
+
+// Only reallocate the framebuffer if its size or depth has changed, so
+// switching between modes with the same framebuffer geometry is instant
+//
+// Only same geometry reuse is done. Mode 7 and Modes 0..6 normally have
+// different widths, and as the physical size of the framebuffer sets the
+// HDMI scaling, one allocation of the larger layout switched with a virtual
+// offset would display the smaller one at the wrong scale, so switching
+// between them still reallocates.
+static void setup_framebuffer(capture_info_t *capinfo) {
+   if (fb_alloc_fb && capinfo->width == fb_alloc_width && capinfo->height == fb_alloc_height && capinfo->bpp == fb_alloc_bpp) {
+      log_debug("Reusing framebuffer");
+      capinfo->fb = fb_alloc_fb;
+      capinfo->pitch = fb_alloc_pitch;
+      osd_update_palette();
+      return;
+   }
+   // Return the old framebuffer to uncached before the GPU reuses its memory
+   map_framebuffer(0);
+   init_framebuffer(capinfo);
+   fb_alloc_width  = capinfo->width;
+   fb_alloc_height = capinfo->height;
+   fb_alloc_bpp    = capinfo->bpp;
+   fb_alloc_pitch  = capinfo->pitch;
+   fb_alloc_fb     = capinfo->fb;
+   map_framebuffer(fbcache);
+}
+
+// Called by rgb_to_fb at the end of each field, before the flip, with the
+// start of the buffer just drawn
+void fb_clean_field(unsigned char *fb) {
+   if (!fb_cached) {
+      return;
+   }
+   if (fb_clean_all) {
+      // Also catches the screen clear and any OSD drawing done outside rgb_to_fb
+      clean_data_cache_range(fb_alloc_fb, fb_alloc_size());
+      fb_clean_all = 0;
+   } else {
+      clean_data_cache_range(fb, fb_alloc_pitch * fb_alloc_height);
+   }
+}
+
+// The buffer rgb_to_fb will draw next, from the flags register at the end of a field
+static int next_draw_buffer(int flags) {
+#ifdef MULTI_BUFFER
+   if (!(flags & (BIT_MODE7 | BIT_PROBE))) {
+      int last = (flags & MASK_LAST_BUFFER) >> OFFSET_LAST_BUFFER;
+      int n = (flags & MASK_NBUFFERS) >> OFFSET_NBUFFERS;
+      return (last < n) ? last + 1 : 0;
+   }
+#endif
+   return 0;
+}
+
+// Called by rgb_to_fb on entry
+//
+// When BIT_CLEAR is set: the capture rewrites every pixel of the active area
+// each field, so only the lines below it and the columns to the right of it
+// need clearing, and each buffer is cleared by fb_clear_step() in the
+// blanking periods before it is drawn, rather than all of them at once with
+// the capture stalled.
+//
+// With scan lines in Modes 0..6, the dark lines of the active area are not
+// written by the capture (see capture_line_default_4bpp_scanlines), but the
+// OSD is drawn over them, so they are zeroed again on every entry, as that
+// covers a new frame buffer, toggling scan lines and any change to the OSD.
+void fb_clear_request(capture_info_t *capinfo, int flags) {
+   clear_fb     = capinfo->fb;
+   clear_pitch  = capinfo->pitch;
+   clear_height = capinfo->height;
+   clear_width  = ((capinfo->width * capinfo->bpp / 8) + 3) & ~3;
+   if (clear_width > clear_pitch) {
+      clear_width = clear_pitch;
+   }
+   clear_active_lines = 2 * capinfo->nlines;
+   if (clear_active_lines > clear_height) {
+      clear_active_lines = clear_height;
+   }
+   clear_active_bytes = capinfo->chars_per_line * capinfo->bpp;
+   if (clear_active_bytes > clear_width) {
+      clear_active_bytes = clear_width;
+   }
+#ifdef HAS_MULTICORE
+   // Only the burst kernels line double on the multi core Pi
+   clear_dark = 1;
+#else
+   clear_dark = 0;
+#endif
+   for (int i = 0; i < FB_CLEAR_BUFFERS; i++) {
+      if (flags & BIT_CLEAR) {
+         clear_line[i] = 0;
+      }
+      if ((flags & BIT_SCANLINES) && !(flags & (BIT_MODE7 | BIT_PROBE | BIT_CALIBRATE))) {
+         dark_line[i] = 1;
+      }
+   }
+   if (flags & BIT_CLEAR) {
+      log_debug("Clear requested: %d active lines, %d active bytes", clear_active_lines, clear_active_bytes);
+   }
+}
+
+// Called by rgb_to_fb in the blanking period, to clear (apart from the OSD
+// bits) as much of the next draw buffer as fits in FB_CLEAR_BUDGET_US, and
+// then to zero its dark lines
+void fb_clear_step(int flags) {
+   int buffer = next_draw_buffer(flags);
+   int line = clear_line[buffer];
+   int dark = dark_line[buffer];
+   if (line >= clear_height && dark == 0) {
+      return;
+   }
+   unsigned int start = RPI_GetSystemTimer();
+   unsigned char *fb = clear_fb + buffer * clear_height * clear_pitch;
+   for (; line < clear_height; line++) {
+      if (RPI_GetSystemTimer() - start > FB_CLEAR_BUDGET_US) {
+         break;
+      }
+      int from = 0;
+      if (line < clear_active_lines && !(clear_dark && (line & 1))) {
+         from = clear_active_bytes;
+      }
+      uint32_t *p = (uint32_t *) (fb + line * clear_pitch + from);
+      for (int i = from; i < clear_width; i += 4) {
+         *p++ &= 0x88888888;
+      }
+   }
+   clear_line[buffer] = line;
+   if (line < clear_height) {
+      return;
+   }
+   for (; dark > 0 && dark < clear_active_lines; dark += 2) {
+      if (RPI_GetSystemTimer() - start > FB_CLEAR_BUDGET_US) {
+         break;
+      }
+      uint32_t *p = (uint32_t *) (fb + dark * clear_pitch);
+      for (int i = 0; i < clear_active_bytes; i += 4) {
+         *p++ = 0;
+      }
+   }
+   dark_line[buffer] = (dark < clear_active_lines) ? dark : 0;
+}
+
+// Point the deinterlace at the comparison buffer, which has the same line layout as the frame buffer
+static void setup_compare_buffer(capture_info_t *capinfo) {
+   int size = capinfo->height * capinfo->pitch;
+   if (size <= COMPARE_BUFFER_SIZE) {
+      memset(compare_buffer, 0, size);
+      compare_base = compare_buffer;
+      compare_fallback = 0;
+   } else {
+      // Fall back to the second frame buffer, which is only unused in Mode 7,
+      // so Modes 0..6 line double rather than use the motion adaptive deinterlace
+      log_warn("Frame buffer too large for the comparison buffer, no motion adaptive deinterlace in Modes 0..6");
+      compare_base = capinfo->fb + size;
+      compare_fallback = 1;
+   }
+   memset(motion_bitmap, 0, sizeof(motion_bitmap));
+}
+
+// Force the next calibrate_sampling_clock() to measure the source again
+static void invalidate_calibration() {
+   for (int i = 0; i < CAL_CACHE_SIZE; i++) {
+      calibration_cache[i].valid = 0;
+   }
+}
+
+// Find a cached calibration for the current mode and configuration
+//
+// nlines_time_ns is measured with the ARM cycle counter, so is independent
+// of the core clock, and must agree with the cached measurement to within
+// CAL_CACHE_PPM.
+static calibration_t *find_calibration(int nlines_time_ns, int nlines) {
+   int bucket = nlines_time_ns / nlines / CAL_BUCKET_NS;
+   for (int i = 0; i < CAL_CACHE_SIZE; i++) {
+      calibration_t *cal = &calibration_cache[i];
+      if (cal->valid && cal->mode7 == mode7 &&
+          abs(cal->line_bucket - bucket) <= 1 && !memcmp(&cal->clkinfo, &clkinfo, sizeof(clkinfo)) &&
+          abs(nlines_time_ns - cal->nlines_time_ns) <= (int) ((double) cal->nlines_time_ns * CAL_CACHE_PPM / 1e6)) {
+         return cal;
+      }
+   }
+   return NULL;
+}
+
+static void add_calibration(int nlines_time_ns, int nlines, int gpclk_divisor, int gpclk_fraction) {
+   int bucket = nlines_time_ns / nlines / CAL_BUCKET_NS;
+   calibration_t *cal = NULL;
+   // Replace any entry with the same key, otherwise the oldest
+   for (int i = 0; i < CAL_CACHE_SIZE; i++) {
+      calibration_t *c = &calibration_cache[i];
+      if (c->valid && c->mode7 == mode7 && c->line_bucket == bucket) {
+         cal = c;
+      }
+   }
+   if (!cal) {
+      cal = &calibration_cache[calibration_next];
+      calibration_next = (calibration_next + 1) % CAL_CACHE_SIZE;
+   }
+   cal->valid = 1;
+   cal->mode7 = mode7;
+   cal->line_bucket = bucket;
+   cal->clkinfo = clkinfo;
+   cal->nlines_time_ns = nlines_time_ns;
+   cal->core_clock = core_clock;
+   cal->gpclk_divisor = gpclk_divisor;
+   cal->gpclk_fraction = gpclk_fraction;
+   cal->vsync_time_ns = vsync_time_ns;
+   cal->clock_error_ppm = clock_error_ppm;
+   cal->interlaced = interlaced;
+}
+
+static void set_core_clock(int new_clock) {
    int a = 13;
-   static int old_clock = 0;
 
+   // Write out any queued log messages, as the UART is about to be re-initialized
+   log_flush();
+
+   // Wait a while to allow UART time to empty
+   for (delay = 0; delay < 100000; delay++) {
+      a = a * 13;
+   }
+
+   // Switch to new core clock speed
+   RPI_PropertyInit();
+   RPI_PropertyAddTag(TAG_SET_CLOCK_RATE, CORE_CLK_ID, new_clock, 1);
+   RPI_PropertyProcess();
+
+   // Re-initialize UART, as system clock rate changed
+   RPI_AuxMiniUartInit(RPI_AuxMiniUartGetBaud(), 8);
+
+   // And remember for next time
+   core_clock = new_clock;
+}
+
+// Restart drift tracking from a calibration made with a line period of ref_line_ns
+static void reset_drift(double ref_line_ns, double line_ns, int gpclk_divisor, int gpclk_fraction) {
+   drift_ref_line_ns = ref_line_ns;
+   drift_line_ns = line_ns;
+   if (fracclock) {
+      drift_divisor = (double) gpclk_divisor + (double) gpclk_fraction / (double) (1 << GPCLK_FRACTION_BITS);
+   } else {
+      drift_divisor = 0;
+   }
+   drift_applied_ppm = 0;
+   clock_drift_ppm = 0;
+   genlock_set_source_drift(0);
+}
+
+static void calibrate_sampling_clock() {
    // Default values for the Beeb
    clkinfo.clock      = 96000000;
    clkinfo.line_len   = 64000;
@@ -303,6 +673,25 @@ static int calibrate_sampling_clock() {
    int         nlines = 100; // Measure over N=100 lines
    int  nlines_ref_ns = nlines * (int) (1e9 * ((double) clkinfo.line_len) / ((double) clkinfo.clock));
    int nlines_time_ns = measure_n_lines(nlines);
+   int nlines_first_ns = nlines_time_ns;
+
+   // If this source timing has been seen before, skip the rest of the calibration
+   calibration_t *cal = calibration_refresh ? NULL : find_calibration(nlines_time_ns, nlines);
+   calibration_refresh = 0;
+   if (cal) {
+      log_info("Using cached calibration (%d ns for %d lines)", nlines_time_ns, nlines);
+      if (cal->core_clock != core_clock) {
+         set_core_clock(cal->core_clock);
+      }
+      init_gpclk(GPCLK_SOURCE, cal->gpclk_divisor, cal->gpclk_fraction, fracclock ? GPCLK_MASH : 0);
+      vsync_time_ns = cal->vsync_time_ns;
+      clock_error_ppm = cal->clock_error_ppm;
+      interlaced = cal->interlaced;
+      genlock_invalidate();
+      // Any difference from the cached line period is corrected as drift
+      reset_drift((double) cal->nlines_time_ns / nlines, (double) nlines_time_ns / nlines, cal->gpclk_divisor, cal->gpclk_fraction);
+      return;
+   }
 
    log_info("     GPCLK Divisor = %d", gpclk_divisor);
    log_info("Nominal core clock = %d Hz", core_freq);
@@ -312,12 +701,13 @@ static int calibrate_sampling_clock() {
    double error = (double) nlines_time_ns / (double) nlines_ref_ns;
    clock_error_ppm = ((error - 1.0) * 1e6);
    log_info("       Clock error = %d PPM", clock_error_ppm);
+   telemetry_event(TM_CLOCK, 0, clock_error_ppm);
 
    int new_clock;
    if (clkinfo.clock_ppm > 0 && abs(clock_error_ppm) > clkinfo.clock_ppm) {
-      if (old_clock > 0) {
+      if (core_clock > 0) {
          log_warn("PPM error too large, using previous clock");
-         new_clock = old_clock;
+         new_clock = core_clock;
       } else {
          log_warn("PPM error too large, using nominal clock");
          new_clock = core_freq;
@@ -334,25 +724,26 @@ static int calibrate_sampling_clock() {
       new_clock = DEFAULT_CORE_CLOCK;
    }
 
-   // If the clock has changed from it's previous value, then actually change it
-   if (new_clock != old_clock) {
-
-      // Wait a while to allow UART time to empty
-      for (delay = 0; delay < 100000; delay++) {
-         a = a * 13;
+   int gpclk_fraction = 0;
+   int clock_changed = 0;
+   if (fracclock) {
+      // Leave the core clock at nominal, and trim the GPCLK divisor instead:
+      // core_freq * 3 / divisor = new_clock * 3 / gpclk_divisor
+      double divisor = (double) gpclk_divisor * (double) core_freq / (double) new_clock;
+      gpclk_divisor = (int) divisor;
+      gpclk_fraction = (int) ((divisor - (double) gpclk_divisor) * (double) (1 << GPCLK_FRACTION_BITS) + 0.5);
+      if (gpclk_fraction == (1 << GPCLK_FRACTION_BITS)) {
+         gpclk_divisor++;
+         gpclk_fraction = 0;
       }
+      log_info("Fractional divisor = %d + %d/%d", gpclk_divisor, gpclk_fraction, 1 << GPCLK_FRACTION_BITS);
+      new_clock = core_freq;
+   }
 
-      // Switch to new core clock speed
-      RPI_Mailbox0Flush(MB0_TAGS_ARM_TO_VC);
-      RPI_PropertyInit();
-      RPI_PropertyAddTag(TAG_SET_CLOCK_RATE, CORE_CLK_ID, new_clock, 1);
-      RPI_PropertyProcess();
-
-      // Re-initialize UART, as system clock rate changed
-      RPI_AuxMiniUartInit(115200, 8);
-
-      // And remember for next time
-      old_clock = new_clock;
+   // If the clock has changed from it's previous value, then actually change it
+   if (new_clock != core_clock) {
+      set_core_clock(new_clock);
+      clock_changed = 1;
    }
 
    // Check the new clock
@@ -361,14 +752,16 @@ static int calibrate_sampling_clock() {
 
    // Finally, set the new divisor
    log_debug("Setting up divisor");
-   init_gpclk(GPCLK_SOURCE, gpclk_divisor);
+   init_gpclk(GPCLK_SOURCE, gpclk_divisor, gpclk_fraction, fracclock ? GPCLK_MASH : 0);
    log_debug("Done setting up divisor");
 
    // Remeasure the vsync time
    vsync_time_ns = measure_vsync();
 
-   // Remeasure the hsync time
-   nlines_time_ns = measure_n_lines(nlines);
+   // Remeasure the hsync time, if the core clock change might have disturbed the first measurement
+   if (clock_changed) {
+      nlines_time_ns = measure_n_lines(nlines);
+   }
 
    // Ignore the interlaced flag, as this can be unreliable (e.g. Monsters)
    vsync_time_ns &= ~INTERLACED_FLAG;
@@ -388,215 +781,85 @@ static int calibrate_sampling_clock() {
    }
 
    // Invalidate the current vlock mode to force an updated, as vsync_time_ns will have changed
-   current_vlockmode = -1;
+   genlock_invalidate();
 
-   return a;
+   // Remember the results for this source timing
+   add_calibration(nlines_first_ns, nlines, gpclk_divisor, gpclk_fraction);
+   reset_drift((double) nlines_first_ns / nlines, (double) nlines_first_ns / nlines, gpclk_divisor, gpclk_fraction);
 }
 
-static void recalculate_hdmi_clock(int vlockmode) {  // use local vsyncmode, not global
-   // The very first time we get called, vsync_time_ns has not been set
-   // so exit gracefully
-   if (vsync_time_ns == 0) {
-      return;
-   }
-
-   // Dump the PLLH registers
-   log_debug("PLLH: PDIV=%d NDIV=%d FRAC=%d AUX=%d RCAL=%d PIX=%d STS=%d",
-             (gpioreg[PLLH_CTRL] >> 12) & 0x7,
-             gpioreg[PLLH_CTRL] & 0x3ff,
-             gpioreg[PLLH_FRAC],
-             gpioreg[PLLH_AUX],
-             gpioreg[PLLH_RCAL],
-             gpioreg[PLLH_PIX],
-             gpioreg[PLLH_STS]);
-
-   // Grab the original PLLH frequency once, at it's original value
-   if (pllh_clock == 0) {
-      pllh_clock = 19.2 * ((double)(gpioreg[PLLH_CTRL] & 0x3ff) + ((double)gpioreg[PLLH_FRAC]) / ((double)(1 << 20)));
-   }
-
-   //for (int i = 0; i < 32; i++) {
-   //   log_debug("   PIXELVALVE2[%2d]: %08x", i, *(PIXELVALVE2_BASE + i));
-   //}
-
-   // Dump the PIXELVALVE2 registers
-   log_debug(" PIXELVALVE2_HORZA: %08x", *PIXELVALVE2_HORZA);
-   log_debug(" PIXELVALVE2_HORZB: %08x", *PIXELVALVE2_HORZB);
-   log_debug(" PIXELVALVE2_VERTA: %08x", *PIXELVALVE2_VERTA);
-   log_debug(" PIXELVALVE2_VERTB: %08x", *PIXELVALVE2_VERTB);
-
-   // Work out the htotal and vtotal by summing the four  16-bit values:
-   // A[31:16] - back porch width in pixels
-   // A[15: 0] - synch width in pixels
-   // B[31:16] - front porch width in pixels
-   // B[15: 0] - active line width in pixels
-   uint32_t htotal = (*PIXELVALVE2_HORZA) + (*PIXELVALVE2_HORZB);
-   htotal = (htotal + (htotal >> 16)) & 0xFFFF;
-   uint32_t vtotal = (*PIXELVALVE2_VERTA) + (*PIXELVALVE2_VERTB);
-   vtotal = (vtotal + (vtotal >> 16)) & 0xFFFF;
-   log_debug("           H-Total: %d pixels", htotal);
-   log_debug("           V-Total: %d pixels", vtotal);
-
-   // PLLH seems to use a fixed divider to generate the pixel clock
-   int fixed_divider = 10;
-   log_debug("     Fixed divider: %d", fixed_divider);
-
-   // 720x576@50    PLLH: PDIV=1 NDIV=56 FRAC=262144 AUX=256 RCAL=256 PIX=4 STS=526655
-   // 1920x1080@50  PLLH: PDIV=1 NDIV=77 FRAC=360448 AUX=256 RCAL=256 PIX=1 STS=526655
-   //     An additional divider is used to get very low pixel clock rates ^
-   int additional_divider = gpioreg[PLLH_PIX];
-   log_debug("Additional divider: %d", additional_divider);
-
-   // Calculate the pixel clock
-   double pixel_clock = pllh_clock / ((double) fixed_divider) / ((double) additional_divider);
-   log_debug("       Pixel Clock: %lf MHz", pixel_clock);
-
-   // Calculate the error between the HDMI VSync and the Source VSync
-   double source_vsync_freq = 2e9 / ((double) vsync_time_ns);
-   double display_vsync_freq = 1e6 * pixel_clock / ((double) htotal) / ((double) vtotal);
-   double error = display_vsync_freq / source_vsync_freq;
-   double error_ppm = 1e6 * (error - 1.0);
-   double f2 = pllh_clock;
-   if (vlockmode > 0) {
-      f2 /= error;
-      f2 /= 1.0 + ((double) (HDMI_EXACT - vlockmode)) / 1000.0;
-   }
-
-   // Sanity check HDMI pixel clock
-   pixel_clock = f2 / ((double) fixed_divider) / ((double) additional_divider);
-   if (pixel_clock < MIN_PIXEL_CLOCK) {
-      log_warn("Pixel clock of %.2lf MHz is too low; leaving unchanged", pixel_clock);
-      f2 = pllh_clock;
-   } else if (pixel_clock > MAX_PIXEL_CLOCK) {
-      log_warn("Pixel clock of %.2lf MHz is too high; leaving unchanged", pixel_clock);
-      f2 = pllh_clock;
+int recalculate_hdmi_clock_line_locked_update() {
+   int target = vlockline;
+#ifdef MULTI_BUFFER
+   if (beamrace) {
+      target = capinfo->nlines - BEAM_RACE_LAG;
    }
+#endif
+   int ret = genlock_update(vlockmode, target, vsync_line, capinfo->height, vsync_time_ns);
+   lock_fail = genlock_lock_failed();
+   return ret;
+}
 
-   log_debug(" Source vsync freq: %lf Hz (measured)",  source_vsync_freq);
-   log_debug("Display vsync freq: %lf Hz",  display_vsync_freq);
-   log_debug("       Vsync error: %lf ppm", error_ppm);
-   log_debug("     Original PLLH: %lf MHz", pllh_clock);
-   log_debug("       Target PLLH: %lf MHz", f2);
-
-   // Calculate the new dividers
-   int div = (int) (f2 / 19.2);
-   int fract = (int) ((double)(1<<20) * (f2 / 19.2 - (double) div));
-   // Sanity check the range of the fractional divider (it should actually always be in range)
-   if (fract < 0) {
-      log_warn("PLLH fraction < 0");
-      fract = 0;
+// Called by rgb_to_fb at the end of each field
+//
+// The source line period is measured from the hsync timestamps of the first
+// and last captured lines, and low pass filtered. Changes since calibration
+// (e.g. as the source warms up) are corrected in the sampling clock (when
+// using the fractional divider) and fed forward into the genlock controller.
+void drift_update(int flags) {
+   if (drift_ref_line_ns == 0 || (flags & BIT_PROBE) || capinfo->nlines < 2) {
+      return;
    }
-   if (fract > (1<<20) - 1) {
-      log_warn("PLLH fraction > 1");
-      fract = (1<<20) - 1;
+   double line_ns = (double) (hsync_last_time - hsync_first_time) / (double) (capinfo->nlines - 1);
+   // Ignore fields with missed lines, or a changed source
+   if (fabs(1e6 * (line_ns / drift_ref_line_ns - 1.0)) > DRIFT_MAX_PPM) {
+      return;
    }
-   // Update the integer divider
-   int old_ctrl = gpioreg[PLLH_CTRL];
-   int old_div = old_ctrl & 0x3ff;
-   if (div != old_div) {
-      gpioreg[PLLH_CTRL] = 0x5A000000 | (old_ctrl & 0x00FFFC00) | div;
-      int new_ctrl = gpioreg[PLLH_CTRL];
-      int new_div = new_ctrl & 0x3ff;
-      if (new_div == div) {
-         log_debug("   New int divider: %d", new_div);
-      } else {
-         log_warn("Failed to write int divider: wrote %d, read back %d", div, new_div);
-      }
+   drift_line_ns += (line_ns - drift_line_ns) / DRIFT_FILTER;
+   double ppm = 1e6 * (drift_line_ns / drift_ref_line_ns - 1.0);
+   if (fabs(ppm - drift_applied_ppm) < DRIFT_STEP_PPM) {
+      return;
    }
-
-   // Update the Fractional Divider
-   int old_fract = gpioreg[PLLH_FRAC];
-   if (fract != old_fract) {
-      gpioreg[PLLH_FRAC] = 0x5A000000 | fract;
-      int new_fract = gpioreg[PLLH_FRAC];
-      if (new_fract == fract) {
-         log_debug(" New fract divider: %d", new_fract);
-      } else {
-         log_warn("Failed to write fract divider: wrote %d, read back %d", fract, new_fract);
-      }
+   drift_applied_ppm = ppm;
+   clock_drift_ppm = (int) ppm;
+   // A longer line period needs a slower sampling clock
+   if (drift_divisor > 0) {
+      set_gpclk_divisor(drift_divisor * (1.0 + ppm * 1e-6));
    }
-
-   // Dump the the actual PLL frequency
-   double f3 = 19.2 * ((double)(gpioreg[PLLH_CTRL] & 0x3ff) + ((double)gpioreg[PLLH_FRAC]) / ((double)(1 << 20)));
-   log_debug("        Final PLLH: %lf MHz", f3);
-
-   log_debug("PLLH: PDIV=%d NDIV=%d FRAC=%d AUX=%d RCAL=%d PIX=%d STS=%d",
-             (gpioreg[PLLH_CTRL] >> 12) & 0x7,
-             gpioreg[PLLH_CTRL] & 0x3ff,
-             gpioreg[PLLH_FRAC],
-             gpioreg[PLLH_AUX],
-             gpioreg[PLLH_RCAL],
-             gpioreg[PLLH_PIX],
-             gpioreg[PLLH_STS]);
+   genlock_set_source_drift(ppm);
+   telemetry_event(TM_CLOCK, 1, clock_drift_ppm);
 }
 
-static void recalculate_hdmi_clock_once(int vlockmode) {
-   if (current_vlockmode != vlockmode){
-      current_vlockmode = vlockmode;
-      recalculate_hdmi_clock(vlockmode);
+#ifdef MULTI_BUFFER
+// Called by rgb_to_fb at the end of each field, returns the updated flags
+//
+// In beam racing mode capture goes into the buffer being displayed, and
+// tearing is avoided by keeping the HDMI scanout behind the capture. This is
+// only safe once genlocked with enough lag, so until then (or if the lag is
+// lost) double buffering is used.
+int beam_race_update(int flags) {
+   if (!beamrace || (flags & (BIT_MODE7 | BIT_PROBE))) {
+      return flags;
    }
-}
-
-int recalculate_hdmi_clock_line_locked_update() {
-   lock_fail = 0;
-   if (vlockmode != HDMI_EXACT) {
-      genlocked = 0;
-      target_difference = 0;
-      resync_count = 0;
-      recalculate_hdmi_clock_once(vlockmode);
-   } else {
-      signed int difference = vsync_line - vlockline;
-      if (abs(difference) > capinfo->height/4) {
-         difference = -difference;
-      }
-      if (genlocked == 1 && abs(difference) > 2) {
-         genlocked = 0;
-         if (difference >= 0) {
-            target_difference = -1;
-         } else {
-            target_difference = 1;
-         }
-         if (abs(difference) > 3) {
-            log_info("Lock lost probably due to mode change - resetting ReSync counter");
-            resync_count = 0;
-            target_difference = 0;
-            lock_fail = 1;
-         } else {
-            log_info("ReSync: %d %d", ++resync_count, target_difference);
-         }
+   // Number of lines captured when the HDMI vsync occurred
+   int lag = capinfo->nlines - vsync_line;
+   if (genlock_is_locked() && lag >= BEAM_RACE_MIN_LAG) {
+      if (beam_race_count < BEAM_RACE_SETTLE && ++beam_race_count == BEAM_RACE_SETTLE) {
+         log_info("Beam racing: single buffered, lag = %d lines", lag);
       }
-      if (genlocked == 0) {
-         if (difference == target_difference) {
-            genlocked = 1;
-            target_difference = 0;
-            recalculate_hdmi_clock_once(HDMI_EXACT);
-            log_info("Locked");
-         } else {
-            if (difference >= target_difference) {
-               if (difference < (20 + target_difference)) {
-                  recalculate_hdmi_clock_once(HDMI_SLOW_1000PPM);
-               } else {
-                  recalculate_hdmi_clock_once(HDMI_SLOW_2000PPM);
-               }
-            } else {
-               if (difference > (-20 + target_difference)) {
-                  recalculate_hdmi_clock_once(HDMI_FAST_1000PPM);
-               } else {
-                  recalculate_hdmi_clock_once(HDMI_FAST_2000PPM);
-               }
-            }
-         }
+   } else {
+      if (beam_race_count >= BEAM_RACE_SETTLE) {
+         log_info("Beam racing: lag lost (%d lines), double buffered", lag);
       }
+      beam_race_count = 0;
    }
-   if (vlockmode != HDMI_EXACT) {
-      // Return 0 if genlock disabled
-      return 0;
-   } else {
-      // Return 1 if genlock enabled but not yet locked
-      // Return 2 if genlock enabled and locked
-      return 1 + genlocked;
+   flags &= ~MASK_NBUFFERS;
+   if (beam_race_count < BEAM_RACE_SETTLE) {
+      flags |= 1 << OFFSET_NBUFFERS;
    }
+   return flags;
 }
+#endif
 
 static void init_hardware() {
    int i;
@@ -639,17 +902,20 @@ static void init_hardware() {
 
    // The divisor us now the same for both modes
    log_debug("Setting up divisor");
-   init_gpclk(GPCLK_SOURCE, DEFAULT_GPCLK_DIVISOR);
+   init_gpclk(GPCLK_SOURCE, DEFAULT_GPCLK_DIVISOR, 0, 0);
    log_debug("Done setting up divisor");
 
    // Initialize the cpld after the gpclk generator has been started
    cpld_init();
+   bootprof_phase("CPLD init");
 
    // Initialize the On-Screen Display
    osd_init();
+   bootprof_phase("OSD init");
 
    // Initialise the info system with cached values (as we break the GPU property interface)
    init_info();
+   bootprof_phase("Info init");
 
 #ifdef DEBUG
    dump_useful_info();
@@ -744,9 +1010,28 @@ static int test_for_elk(capture_info_t *capinfo, int elk, int mode7) {
 }
 
 #ifdef HAS_MULTICORE
+// Each secondary core waits in the firmware's armstub for a start address in
+// its mailbox 3, and clears the mailbox when it jumps to it
 static void start_core(int core, func_ptr func) {
-   printf("starting core %d\r\n", core);
-   *(unsigned int *)(0x4000008C + 0x10 * core) = (unsigned int) func;
+   volatile uint32_t *mbox_set = (volatile uint32_t *)(0x4000008C + 0x10 * core);
+   volatile uint32_t *mbox_clr = (volatile uint32_t *)(0x400000CC + 0x10 * core);
+   log_info("starting core %d", core);
+   *mbox_set = (unsigned int) func;
+   asm volatile ("dsb\n\tsev" : : : "memory");
+   uint32_t start = RPI_GetSystemTimer();
+   while (*mbox_clr) {
+      if (RPI_GetSystemTimer() - start > CORE_START_TIMEOUT_US) {
+         log_warn("core %d did not start", core);
+         return;
+      }
+   }
+}
+
+// Called from _init_core on core 1
+void run_core() {
+   enable_MMU_secondary();
+   _enable_unaligned_access();
+   majority_core();
 }
 #endif
 
@@ -1087,13 +1372,11 @@ int total_N_frames(capture_info_t *capinfo, int n, int mode7, int elk) {
 
 #ifdef MULTI_BUFFER
 void swapBuffer(int buffer) {
-   // Flush the previous response from the GPU->ARM mailbox
-   // Doing it like this avoids stalling for the response
-   RPI_Mailbox0Flush(MB0_TAGS_ARM_TO_VC);
-   RPI_PropertyInit();
-   RPI_PropertyAddTag(TAG_SET_VIRTUAL_OFFSET, 0, capinfo->height * buffer);
-   // Use version that doesn't wait for the response
-   RPI_PropertyProcessNoCheck();
+   // Add to this field's mailbox batch, which rgb_to_fb submits at the end
+   // of the field without waiting for the response
+   RPI_PropertyBatchAddTag(TAG_SET_VIRTUAL_OFFSET, 0, capinfo->height * buffer);
+   telemetry_event(TM_FLIP, buffer, 0);
+   latency_flip_requested(buffer);
 }
 #endif
 
@@ -1114,6 +1397,14 @@ int get_scanlines() {
    return scanlines;
 }
 
+void set_majority(int on) {
+   majority = on;
+}
+
+int get_majority() {
+   return majority;
+}
+
 void set_elk(int on) {
    elk = on;
    clear = BIT_CLEAR;
@@ -1132,7 +1423,7 @@ int get_vsync() {
 }
 
 void set_vlockmode(int val) {
-   genlocked = 0;
+   genlock_reset();
    vlockmode = val;
    recalculate_hdmi_clock_line_locked_update();
 }
@@ -1142,7 +1433,7 @@ int get_vlockmode() {
 }
 
 void set_vlockline(int val) {
-   genlocked = 0;
+   genlock_reset();
    vlockline = val;
    if (vlockline > capinfo->height/4) {
       default_vsync_line = 1;
@@ -1155,6 +1446,38 @@ int get_vlockline() {
    return vlockline;
 }
 
+void set_vlockadj(int val) {
+   vlockadj = val;
+   genlock_set_mode_match(vlockadj);
+}
+
+int get_vlockadj() {
+   return vlockadj;
+}
+
+void set_fracclock(int on) {
+   if (on != fracclock) {
+      fracclock = on;
+      // Recalibrate with the new method
+      invalidate_calibration();
+      recalibrate = 1;
+   }
+}
+
+int get_fracclock() {
+   return fracclock;
+}
+
+void set_fbcache(int on) {
+   fbcache = on;
+   // Not called during capture, so the mapping can be changed straight away
+   map_framebuffer(fbcache);
+}
+
+int get_fbcache() {
+   return fbcache;
+}
+
 #ifdef MULTI_BUFFER
 int get_nbuffers() {
    return nbuffers;
@@ -1163,6 +1486,22 @@ int get_nbuffers() {
 void set_nbuffers(int val) {
    nbuffers=val;
 }
+
+void set_beamrace(int on) {
+   beamrace = on;
+   beam_race_count = 0;
+   genlock_reset();
+   if (beamrace) {
+      // The vsync target is near the top of the capture
+      default_vsync_line = 1;
+   } else {
+      set_vlockline(vlockline);
+   }
+}
+
+int get_beamrace() {
+   return beamrace;
+}
 #endif
 
 void set_debug(int on) {
@@ -1183,6 +1522,7 @@ int get_m7disable() {
 
 void action_calibrate_clocks() {
    // re-measure vsync and set the core/sampling clocks
+   invalidate_calibration();
    calibrate_sampling_clock();
    // set the hdmi clock property to match exactly
    set_vlockmode(HDMI_EXACT);
@@ -1190,6 +1530,7 @@ void action_calibrate_clocks() {
 
 void action_calibrate_auto() {
    // re-measure vsync and set the core/sampling clocks
+   invalidate_calibration();
    calibrate_sampling_clock();
    // During calibration we do our best to auto-delect an Electron
    elk = test_for_elk(capinfo, elk, mode7);
@@ -1200,7 +1541,7 @@ void action_calibrate_auto() {
 }
 
 int is_genlocked() {
-   return genlocked;
+   return genlock_is_locked();
 }
 
 void rgb_to_hdmi_main() {
@@ -1224,6 +1565,7 @@ void rgb_to_hdmi_main() {
 
    // Determine initial mode
    mode7 = rgb_to_fb(capinfo, BIT_PROBE) & BIT_MODE7 & (!m7disable);
+   bootprof_phase("Mode probe");
 
    // Default to capturing indefinitely
    ncapture = -1;
@@ -1234,6 +1576,7 @@ void rgb_to_hdmi_main() {
       capinfo = mode7 ? &mode7_capinfo : &default_capinfo;
 
       log_debug("Setting mode7 = %d", mode7);
+      telemetry_event(TM_MODE, mode7, 0);
 
       geometry_set_mode(mode7);
       geometry_get_fb_params(capinfo);
@@ -1243,17 +1586,24 @@ void rgb_to_hdmi_main() {
       log_debug("Done loading sample points");
 
       log_debug("Setting up frame buffer");
-      init_framebuffer(capinfo);
+      setup_framebuffer(capinfo);
+      setup_compare_buffer(capinfo);
+      teletext_reset(capinfo);
+      majority_reset(capinfo);
       log_debug("Done setting up frame buffer");
+      bootprof_phase("Framebuffer init");
 
       // Measure the frame time and set the sampling clock
       calibrate_sampling_clock();
+      bootprof_phase("Clock calibration");
 
       // Recalculate the HDMI clock (if the vlockmode property requires this)
       recalculate_hdmi_clock_line_locked_update();
 
       clear = BIT_CLEAR;
 
+      latency_reset();
+
       osd_refresh();
 
       do {
@@ -1277,14 +1627,32 @@ void rgb_to_hdmi_main() {
          if (scanlines) {
             flags |= BIT_SCANLINES;
          }
+         if (majority) {
+            flags |= BIT_MAJORITY;
+         }
          if (osd_active()) {
             flags |= BIT_OSD;
          }
-         flags |= deinterlace << OFFSET_INTERLACE;
+         if (compare_fallback && !mode7 && deinterlace >= DEINTERLACE_MA1) {
+            // The comparison buffer is a display buffer, see setup_compare_buffer()
+            flags |= DEINTERLACE_BOB << OFFSET_INTERLACE;
+         } else {
+            flags |= deinterlace << OFFSET_INTERLACE;
+         }
 #ifdef MULTI_BUFFER
-         flags |= nbuffers << OFFSET_NBUFFERS;
+         if (beamrace) {
+            // Start double buffered, beam_race_update() switches to single buffered
+            flags |= 1 << OFFSET_NBUFFERS;
+         } else {
+            flags |= nbuffers << OFFSET_NBUFFERS;
+         }
 #endif
          capinfo->ncapture = ncapture;
+         fb_clean_all = 1;
+         latency_restart();
+         // The first field is captured from here (this is only logged once)
+         bootprof_phase("Capture start");
+         bootprof_report();
          log_debug("Entering rgb_to_fb, flags=%08x", flags);
          result = rgb_to_fb(capinfo, flags);
          log_debug("Leaving rgb_to_fb, result=%04x", result);
@@ -1320,13 +1688,21 @@ void rgb_to_hdmi_main() {
             clear = BIT_CLEAR;
          }
 
-         if (clk_changed || (result & RET_INTERLACE_CHANGED) || lock_fail != 0) {
-            target_difference = 0;
-            resync_count = 0;
+         if (clk_changed || (result & RET_INTERLACE_CHANGED) || lock_fail != 0 || recalibrate) {
+            recalibrate = 0;
+            genlock_reset();
+            if (result & RET_INTERLACE_CHANGED) {
+               // The cached calibration has the old field type, so measure again and replace it
+               calibration_refresh = 1;
+            }
+            if (lock_fail != 0) {
+               invalidate_calibration();
+            }
             // Measure the frame time and set the sampling clock
             calibrate_sampling_clock();
             // Recalculate the HDMI clock (if the vlockmode property requires this)
             recalculate_hdmi_clock_line_locked_update();
+            latency_reset();
          }
 
       } while (!mode_changed && !fb_size_changed);
@@ -1337,27 +1713,25 @@ void rgb_to_hdmi_main() {
 
 void kernel_main(unsigned int r0, unsigned int r1, unsigned int atags)
 {
+   bootprof_phase("Kernel start");
+
    RPI_AuxMiniUartInit(115200, 8);
 
    log_info("RGB to HDMI booted");
 
    enable_MMU_and_IDCaches();
    _enable_unaligned_access();
+   bootprof_phase("MMU and caches");
 
    init_hardware();
 
 #ifdef HAS_MULTICORE
-   int i;
-
-   printf("main running on core %u\r\n", _get_core());
+   log_info("main running on core %u", _get_core());
 
-   for (i = 0; i < 10000000; i++);
-   start_core(1, _spin_core);
-   for (i = 0; i < 10000000; i++);
+   start_core(1, _init_core);
    start_core(2, _spin_core);
-   for (i = 0; i < 10000000; i++);
    start_core(3, _spin_core);
-   for (i = 0; i < 10000000; i++);
+   bootprof_phase("Cores started");
 #endif
 
    rgb_to_hdmi_main();
@@ -6,6 +6,8 @@ void set_deinterlace(int value);
 int  get_deinterlace();
 void set_scanlines(int on);
 int  get_scanlines();
+void set_majority(int on);
+int  get_majority();
 void set_elk(int on);
 int  get_elk();
 void set_vsync(int on);
@@ -14,9 +16,17 @@ void set_vlockmode(int val);
 int  get_vlockmode();
 void set_vlockline(int val);
 int  get_vlockline();
+void set_vlockadj(int val);
+int  get_vlockadj();
+void set_fracclock(int on);
+int  get_fracclock();
+void set_fbcache(int on);
+int  get_fbcache();
 #ifdef MULTI_BUFFER
 void set_nbuffers(int val);
 int  get_nbuffers();
+void set_beamrace(int on);
+int  get_beamrace();
 #endif
 void set_m7disable(int on);
 int  get_m7disable();
@@ -17,6 +17,8 @@
 
 static aux_t* auxillary = (aux_t*) AUX_BASE;
 
+static int uart_baud = 115200;
+
 aux_t* RPI_GetAux(void)
 {
    return auxillary;
@@ -100,6 +102,7 @@ void RPI_AuxMiniUartInit(int baud, int bits)
 
    /* Transposed calculation from Section 2.2.1 of the ARM peripherals manual */
    auxillary->MU_BAUD = ( sys_freq / (8 * baud)) - 1;
+   uart_baud = baud;
 
 #ifdef USE_IRQ
    tx_buffer = malloc(TX_BUFFER_SIZE);
@@ -164,9 +167,47 @@ void RPI_AuxMiniUartWrite(char c)
 #endif
 }
 
+int RPI_AuxMiniUartGetBaud(void)
+{
+   return uart_baud;
+}
+
+// Non-blocking version of RPI_AuxMiniUartWrite, returns 0 if there was no space
+int RPI_AuxMiniUartTryWrite(char c)
+{
+#ifdef USE_IRQ
+   int tmp_head = (tx_head + 1) & (TX_BUFFER_SIZE - 1);
+   if (tmp_head == tx_tail) {
+      return 0;
+   }
+   tx_buffer[tmp_head] = c;
+   tx_head = tmp_head;
+   auxillary->MU_IER |= AUX_MUIER_TX_INT;
+#else
+   if ((auxillary->MU_LSR & AUX_MULSR_TX_EMPTY) == 0) {
+      return 0;
+   }
+   auxillary->MU_IO = c;
+#endif
+   return 1;
+}
+
+// Returns non-zero once every character written has actually been sent
+int RPI_AuxMiniUartTxIdle(void)
+{
+#ifdef USE_IRQ
+   if (tx_head != tx_tail) {
+      return 0;
+   }
+#endif
+   return auxillary->MU_LSR & AUX_MULSR_TX_IDLE;
+}
+
 extern void RPI_EnableUart(char* pMessage)
 {
    RPI_AuxMiniUartInit(115200, 8);          // Initialise the UART
 
-   printf(pMessage);
+   while (*pMessage) {
+      RPI_AuxMiniUartWrite(*pMessage++);
+   }
 }
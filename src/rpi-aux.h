@@ -195,6 +195,9 @@ typedef struct
 extern aux_t* RPI_GetAux(void);
 extern void RPI_AuxMiniUartInit(int baud, int bits);
 extern void RPI_AuxMiniUartWrite(char c);
+extern int RPI_AuxMiniUartGetBaud(void);
+extern int RPI_AuxMiniUartTryWrite(char c);
+extern int RPI_AuxMiniUartTxIdle(void);
 extern void RPI_EnableUart(char* pMessage);
 
 #endif
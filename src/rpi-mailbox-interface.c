@@ -6,7 +6,9 @@
 #include "rpi-mailbox-interface.h"
 #include "cache.h"
 #include "defs.h"
+#include "logging.h"
 #include "osd.h"
+#include "startup.h"
 
 /* Make sure the property tag buffer is aligned to a 16-byte boundary because
    we only have 28-bits available in the property interface protocol to pass
@@ -14,8 +16,63 @@
 static int *pt = ( int *) UNCACHED_MEM_BASE ;// [PROP_BUFFER_SIZE] __attribute__((aligned(16)));
 static int pt_index ;
 
+/* Buffers for the queued (asynchronous) property interface. These live in
+   the uncached region between the blocking property buffer and the channel 1
+   framebuffer structure. */
+#define PROP_QUEUE_BASE  ( UNCACHED_MEM_BASE + 0x8000 )
+
+typedef enum {
+   PROP_QUEUE_FREE = 0,
+   PROP_QUEUE_BUILDING,
+   PROP_QUEUE_PENDING,
+   PROP_QUEUE_COMPLETE
+} prop_queue_state_t;
+
+typedef struct {
+   int *buf;
+   int index;
+   prop_queue_state_t state;
+   int release;
+   unsigned int submit_time;
+} prop_queue_entry_t;
+
+static prop_queue_entry_t prop_queue[PROP_QUEUE_DEPTH];
+static int prop_queue_next;
+
+/* Queue buffer accumulating the tags for the current field, or -1 */
+static int prop_batch = -1;
+
+/* Latency statistics, in ARM cycles */
+static unsigned int prop_latency_histogram[PROP_LATENCY_BUCKETS];
+static prop_latency_stats_t prop_latency_stats[PROP_LATENCY_TAGS];
+
 //#define PRINT_PROP_DEBUG 1
 
+static void property_record_latency( int *buf, unsigned int cycles )
+{
+    int bucket = 0;
+    int i;
+
+    /* Bucket 0 is < 1024 cycles, each subsequent bucket doubles */
+    while( ( cycles >> ( 10 + bucket ) ) && ( bucket < PROP_LATENCY_BUCKETS - 1 ) )
+        bucket++;
+    prop_latency_histogram[bucket]++;
+
+    /* Attribute the transaction to the first tag in the buffer */
+    for( i = 0; i < PROP_LATENCY_TAGS; i++ )
+    {
+        if( prop_latency_stats[i].count == 0 || prop_latency_stats[i].tag == buf[2] )
+        {
+            prop_latency_stats[i].tag = buf[2];
+            prop_latency_stats[i].count++;
+            prop_latency_stats[i].total += cycles;
+            if( cycles > prop_latency_stats[i].max )
+                prop_latency_stats[i].max = cycles;
+            break;
+        }
+    }
+}
+
 
 void RPI_PropertyInit( void )
 {
@@ -42,14 +99,12 @@ void RPI_PropertyInit( void )
 }
 
 /**
-    @brief Add a property tag to the current tag list. Data can be included. All data is uint32_t
+    @brief Add a property tag to a tag list. Data can be included. All data is uint32_t
     @param tag
 */
-void RPI_PropertyAddTag( rpi_mailbox_tag_t tag, ... )
+static int property_add_tag( int *pt, int pt_index, rpi_mailbox_tag_t tag, va_list vl )
 {
     int num_colours;
-    va_list vl;
-    va_start( vl, tag );
 
     pt[pt_index++] = tag;
 
@@ -216,6 +271,14 @@ void RPI_PropertyAddTag( rpi_mailbox_tag_t tag, ... )
     /* Make sure the tags are 0 terminated to end the list and update the buffer size */
     pt[pt_index] = 0;
 
+    return pt_index;
+}
+
+void RPI_PropertyAddTag( rpi_mailbox_tag_t tag, ... )
+{
+    va_list vl;
+    va_start( vl, tag );
+    pt_index = property_add_tag( pt, pt_index, tag, vl );
     va_end( vl );
 }
 
@@ -223,6 +286,7 @@ void RPI_PropertyAddTag( rpi_mailbox_tag_t tag, ... )
 int RPI_PropertyProcess( void )
 {
     int result;
+    unsigned int start;
 
 #if( PRINT_PROP_DEBUG == 1 )
     int i;
@@ -236,9 +300,17 @@ int RPI_PropertyProcess( void )
     for( i = 0; i < (pt[PT_OSIZE] >> 2); i++ )
         log_info( "Request: %3d %8.8X", i, pt[i] );
 #endif
+    start = _get_cycle_counter();
     RPI_Mailbox0Write( MB0_TAGS_ARM_TO_VC, (unsigned int)pt );
 
-    result = RPI_Mailbox0Read( MB0_TAGS_ARM_TO_VC );
+    /* Responses to queued buffers may be ahead of ours in the mailbox; these
+       are simply discarded, as completion is tracked in the buffers themselves */
+    do
+    {
+        result = RPI_Mailbox0Read( MB0_TAGS_ARM_TO_VC );
+    } while( result != ( (int)pt >> 4 ) );
+
+    property_record_latency( pt, _get_cycle_counter() - start );
 
 #if( PRINT_PROP_DEBUG == 1 )
     for( i = 0; i < (pt[PT_OSIZE] >> 2); i++ )
@@ -247,24 +319,20 @@ int RPI_PropertyProcess( void )
     return result;
 }
 
-void RPI_PropertyProcessNoCheck( void )
+static int property_find_tag( int *pt, int pt_index, rpi_mailbox_tag_t tag )
 {
-#if( PRINT_PROP_DEBUG == 1 )
-    int i;
-    log_info( "%s Length: %d", __func__, pt[PT_OSIZE] );
-#endif
-    /* Fill in the size of the buffer */
-    pt[PT_OSIZE] = ( pt_index + 1 ) << 2;
-    pt[PT_OREQUEST_OR_RESPONSE] = 0;
+    int index = 2;
 
-#if( PRINT_PROP_DEBUG == 1 )
-    for( i = 0; i < (pt[PT_OSIZE] >> 2); i++ )
-        log_info( "Request: %3d %8.8X", i, pt[i] );
-#endif
-    RPI_Mailbox0Write( MB0_TAGS_ARM_TO_VC, (unsigned int)pt );
+    while( index < pt_index )
+    {
+        if( pt[index] == tag )
+            return index;
+        index += ( pt[index + 1] >> 2 ) + 3;
+    }
+    return -1;
 }
 
-rpi_mailbox_property_t* RPI_PropertyGet( rpi_mailbox_tag_t tag)
+static rpi_mailbox_property_t* property_get( int *pt, rpi_mailbox_tag_t tag )
 {
     static rpi_mailbox_property_t property;
     int* tag_buffer = NULL;
@@ -297,3 +365,200 @@ rpi_mailbox_property_t* RPI_PropertyGet( rpi_mailbox_tag_t tag)
 
     return &property;
 }
+
+rpi_mailbox_property_t* RPI_PropertyGet( rpi_mailbox_tag_t tag )
+{
+    return property_get( pt, tag );
+}
+
+/**
+    @brief Start building a new queued property request. If all the queue
+    buffers are in use this waits for the oldest one to complete.
+    @return handle to pass to the other RPI_PropertyQueue functions
+*/
+int RPI_PropertyQueueInit( void )
+{
+    int i;
+    int handle;
+    prop_queue_entry_t *entry;
+
+    RPI_PropertyQueueDrain();
+
+    for( i = 0; i < PROP_QUEUE_DEPTH; i++ )
+    {
+        handle = ( prop_queue_next + i ) % PROP_QUEUE_DEPTH;
+        if( prop_queue[handle].state == PROP_QUEUE_FREE )
+            break;
+    }
+
+    if( i == PROP_QUEUE_DEPTH )
+    {
+        /* Everything is in use, so wait for the oldest in flight buffer that
+           is released as soon as it completes. A completed buffer that hasn't
+           been released still belongs to its owner, so is never recycled */
+        for( i = 0; i < PROP_QUEUE_DEPTH; i++ )
+        {
+            handle = ( prop_queue_next + i ) % PROP_QUEUE_DEPTH;
+            if( prop_queue[handle].state == PROP_QUEUE_PENDING && prop_queue[handle].release )
+                break;
+        }
+        if( i == PROP_QUEUE_DEPTH )
+        {
+            log_fatal( "Property queue: every buffer is held by its owner" );
+            while( 1 ) { }
+        }
+        RPI_PropertyQueueWait( handle );
+    }
+    prop_queue_next = ( handle + 1 ) % PROP_QUEUE_DEPTH;
+
+    entry = &prop_queue[handle];
+    entry->buf = (int *)( PROP_QUEUE_BASE + handle * PROP_QUEUE_SIZE );
+    entry->state = PROP_QUEUE_BUILDING;
+    entry->release = 0;
+    entry->buf[PT_OSIZE] = 12;
+    entry->buf[PT_OREQUEST_OR_RESPONSE] = 0;
+    entry->index = 2;
+    entry->buf[entry->index] = 0;
+
+    return handle;
+}
+
+void RPI_PropertyQueueAddTag( int handle, rpi_mailbox_tag_t tag, ... )
+{
+    prop_queue_entry_t *entry = &prop_queue[handle];
+    va_list vl;
+    va_start( vl, tag );
+    entry->index = property_add_tag( entry->buf, entry->index, tag, vl );
+    va_end( vl );
+}
+
+/**
+    @brief Hand a queued property request to the VC without waiting for it
+    @param release if non-zero the buffer is recycled as soon as it completes
+    and the response is never looked at
+*/
+void RPI_PropertyQueueSubmit( int handle, int release )
+{
+    prop_queue_entry_t *entry = &prop_queue[handle];
+
+    entry->buf[PT_OSIZE] = ( entry->index + 1 ) << 2;
+    entry->buf[PT_OREQUEST_OR_RESPONSE] = 0;
+    entry->release = release;
+    entry->state = PROP_QUEUE_PENDING;
+    entry->submit_time = _get_cycle_counter();
+
+    RPI_Mailbox0Write( MB0_TAGS_ARM_TO_VC, (unsigned int)entry->buf );
+}
+
+/**
+    @brief Check (without blocking) whether a queued request has completed
+    @return non-zero once the response is available
+*/
+int RPI_PropertyQueuePoll( int handle )
+{
+    prop_queue_entry_t *entry = &prop_queue[handle];
+
+    if( entry->state == PROP_QUEUE_PENDING )
+    {
+        /* The VC sets bit 31 of the response code once it's done with the buffer */
+        if( !( entry->buf[PT_OREQUEST_OR_RESPONSE] & 0x80000000 ) )
+            return 0;
+
+        property_record_latency( entry->buf, _get_cycle_counter() - entry->submit_time );
+        entry->state = entry->release ? PROP_QUEUE_FREE : PROP_QUEUE_COMPLETE;
+    }
+    return entry->state != PROP_QUEUE_BUILDING;
+}
+
+void RPI_PropertyQueueWait( int handle )
+{
+    while( !RPI_PropertyQueuePoll( handle ) ) { }
+}
+
+rpi_mailbox_property_t* RPI_PropertyQueueGet( int handle, rpi_mailbox_tag_t tag )
+{
+    RPI_PropertyQueueWait( handle );
+    return property_get( prop_queue[handle].buf, tag );
+}
+
+void RPI_PropertyQueueRelease( int handle )
+{
+    RPI_PropertyQueueWait( handle );
+    prop_queue[handle].state = PROP_QUEUE_FREE;
+}
+
+/**
+    @brief Retire any completed queued requests and empty the response
+    mailbox. This never blocks, so it can be called from the capture loop
+    during blanking.
+    @return the number of requests still in flight
+*/
+int RPI_PropertyQueueDrain( void )
+{
+    int i;
+    int pending = 0;
+
+    RPI_Mailbox0Flush( MB0_TAGS_ARM_TO_VC );
+
+    for( i = 0; i < PROP_QUEUE_DEPTH; i++ )
+    {
+        if( prop_queue[i].state == PROP_QUEUE_PENDING && !RPI_PropertyQueuePoll( i ) )
+            pending++;
+    }
+    return pending;
+}
+
+/**
+    @brief Add a tag to the batch for the current field. If the same tag is
+    already in the batch, the earlier request is superseded. Nothing is sent
+    until RPI_PropertyBatchSubmit is called (by rgb_to_fb, at the end of the
+    field) so everything wanted this field goes in a single mailbox write.
+*/
+void RPI_PropertyBatchAddTag( rpi_mailbox_tag_t tag, ... )
+{
+    prop_queue_entry_t *entry;
+    int index;
+    int length;
+    va_list vl;
+
+    if( prop_batch < 0 )
+        prop_batch = RPI_PropertyQueueInit();
+    entry = &prop_queue[prop_batch];
+
+    index = property_find_tag( entry->buf, entry->index, tag );
+    if( index >= 0 )
+    {
+        length = ( entry->buf[index + 1] >> 2 ) + 3;
+        memmove( &entry->buf[index], &entry->buf[index + length], ( entry->index - index - length ) << 2 );
+        entry->index -= length;
+        entry->buf[entry->index] = 0;
+    }
+
+    va_start( vl, tag );
+    entry->index = property_add_tag( entry->buf, entry->index, tag, vl );
+    va_end( vl );
+}
+
+/**
+    @brief Submit the tags batched for this field, if any, without waiting
+*/
+void RPI_PropertyBatchSubmit( void )
+{
+    if( prop_batch >= 0 )
+    {
+        RPI_PropertyQueueSubmit( prop_batch, 1 );
+        prop_batch = -1;
+    }
+}
+
+const unsigned int *RPI_PropertyLatencyHistogram( void )
+{
+    return prop_latency_histogram;
+}
+
+const prop_latency_stats_t *RPI_PropertyLatencyStats( int i )
+{
+    if( i < 0 || i >= PROP_LATENCY_TAGS || prop_latency_stats[i].count == 0 )
+        return NULL;
+    return &prop_latency_stats[i];
+}
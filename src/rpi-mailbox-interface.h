@@ -4,6 +4,14 @@
 #define PROP_BUFFER_SIZE 8192
 #define PROP_SIZE        1024
 
+/* Queued property interface: number and size (in bytes) of buffers */
+#define PROP_QUEUE_DEPTH 4
+#define PROP_QUEUE_SIZE  0x800
+
+/* Latency histogram: bucket 0 is < 1024 ARM cycles, then doubling */
+#define PROP_LATENCY_BUCKETS 16
+#define PROP_LATENCY_TAGS    8
+
 
 /**
    @brief An enum of the RPI->Videocore firmware mailbox property interface
@@ -123,6 +131,14 @@ typedef struct {
 } rpi_mailbox_property_t;
 
 
+typedef struct {
+   int tag;
+   unsigned int count;
+   unsigned long long total;
+   unsigned int max;
+} prop_latency_stats_t;
+
+
 /* Clock ID values */
 #define   RES_CLK_ID 0x000000000
 #define  EMMC_CLK_ID 0x000000001
@@ -142,7 +158,21 @@ typedef struct {
 extern void RPI_PropertyInit( void );
 extern void RPI_PropertyAddTag( rpi_mailbox_tag_t tag, ... );
 extern int RPI_PropertyProcess( void );
-extern void RPI_PropertyProcessNoCheck( void );
 extern rpi_mailbox_property_t* RPI_PropertyGet( rpi_mailbox_tag_t tag );
 
+extern int RPI_PropertyQueueInit( void );
+extern void RPI_PropertyQueueAddTag( int handle, rpi_mailbox_tag_t tag, ... );
+extern void RPI_PropertyQueueSubmit( int handle, int release );
+extern int RPI_PropertyQueuePoll( int handle );
+extern void RPI_PropertyQueueWait( int handle );
+extern rpi_mailbox_property_t* RPI_PropertyQueueGet( int handle, rpi_mailbox_tag_t tag );
+extern void RPI_PropertyQueueRelease( int handle );
+extern int RPI_PropertyQueueDrain( void );
+
+extern void RPI_PropertyBatchAddTag( rpi_mailbox_tag_t tag, ... );
+extern void RPI_PropertyBatchSubmit( void );
+
+extern const unsigned int *RPI_PropertyLatencyHistogram( void );
+extern const prop_latency_stats_t *RPI_PropertyLatencyStats( int i );
+
 #endif
@@ -0,0 +1,7 @@
+#include "rpi-systimer.h"
+
+static rpi_sys_timer_t *rpiSystemTimer = (rpi_sys_timer_t *)RPI_SYSTIMER_BASE;
+
+uint32_t RPI_GetSystemTimer(void) {
+   return rpiSystemTimer->counter_lo;
+}
@@ -0,0 +1,25 @@
+// rpi-systimer.h
+
+#ifndef RPI_SYSTIMER_H
+#define RPI_SYSTIMER_H
+
+#include "rpi-base.h"
+
+// The system timer is a free running 1MHz counter, that is unaffected
+// by changes to the core or ARM clock, so it makes a good timestamp source
+#define RPI_SYSTIMER_BASE   (PERIPHERAL_BASE + 0x3000UL)
+
+typedef struct {
+   rpi_reg_rw_t control_status;
+   rpi_reg_ro_t counter_lo;
+   rpi_reg_ro_t counter_hi;
+   rpi_reg_rw_t compare0;
+   rpi_reg_rw_t compare1;
+   rpi_reg_rw_t compare2;
+   rpi_reg_rw_t compare3;
+} rpi_sys_timer_t;
+
+// Returns the low 32 bits of the system timer, in microseconds
+extern uint32_t RPI_GetSystemTimer(void);
+
+#endif
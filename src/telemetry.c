@@ -0,0 +1,130 @@
+#include <string.h>
+#include "defs.h"
+#include "logging.h"
+#include "rgb_to_fb.h"
+#include "rpi-aux.h"
+#include "rpi-systimer.h"
+#include "telemetry.h"
+
+#define TELEMETRY_RING_SIZE 512  // Must be a power of 2
+
+#define FRAME_FLAG    0x7E
+#define FRAME_ESCAPE  0x7D
+
+// =============================================================
+// Local variables
+// =============================================================
+
+static telemetry_record_t ring[TELEMETRY_RING_SIZE];
+
+static volatile unsigned int head;
+static volatile unsigned int tail;
+
+static int enabled;
+static int dropped;
+static uint16_t field;
+
+// =============================================================
+// Private methods
+// =============================================================
+
+static void put_record(int type, int arg, int value) {
+   telemetry_record_t *rec = &ring[head];
+   rec->timestamp = RPI_GetSystemTimer();
+   rec->field     = field;
+   rec->type      = type;
+   rec->arg       = arg;
+   rec->value     = value;
+   head = (head + 1) & (TELEMETRY_RING_SIZE - 1);
+}
+
+static int put_byte(char *buffer, int len, uint8_t c) {
+   if (c == FRAME_FLAG || c == FRAME_ESCAPE) {
+      buffer[len++] = FRAME_ESCAPE;
+      c ^= 0x20;
+   }
+   buffer[len++] = c;
+   return len;
+}
+
+// =============================================================
+// Public methods
+// =============================================================
+
+void telemetry_enable(int baud) {
+   if (baud > 0) {
+      if (baud == 1) {
+         baud = TELEMETRY_DEFAULT_BAUD;
+      }
+      log_info("Telemetry enabled, switching UART to %d baud", baud);
+      log_flush();
+      RPI_AuxMiniUartInit(baud, 8);
+      enabled = 1;
+   } else {
+      enabled = 0;
+   }
+}
+
+int telemetry_enabled() {
+   return enabled;
+}
+
+void telemetry_event(int type, int arg, int value) {
+   if (!enabled) {
+      return;
+   }
+   // One slot is always left empty, so a full ring can be told from an empty one,
+   // and a pending TM_DROPPED record must go in with the event
+   unsigned int space = (tail - head - 1) & (TELEMETRY_RING_SIZE - 1);
+   if (space < (dropped ? 2 : 1)) {
+      dropped++;
+      return;
+   }
+   if (dropped) {
+      put_record(TM_DROPPED, 0, dropped);
+      dropped = 0;
+   }
+   put_record(type, arg, value);
+}
+
+void telemetry_field(int flags) {
+   field++;
+   telemetry_event(TM_FIELD,
+                   ((flags & BIT_FIELD_TYPE) ? TM_FIELD_EVEN : 0) | ((flags & BIT_MODE7) ? TM_FIELD_MODE7 : 0) |
+                   ((flags & BIT_STATIC) ? TM_FIELD_STATIC : 0),
+                   vsync_line);
+}
+
+int telemetry_frame(char *buffer, int size) {
+   uint8_t payload[sizeof(telemetry_record_t)];
+   telemetry_record_t *rec;
+   uint8_t checksum = 0;
+   int len = 0;
+   int i;
+   // Worst case every byte is escaped, plus the checksum and two flags
+   if (tail == head || size < 2 * (sizeof(payload) + 1) + 2) {
+      return 0;
+   }
+   rec = &ring[tail];
+   payload[0]  = rec->timestamp;
+   payload[1]  = rec->timestamp >> 8;
+   payload[2]  = rec->timestamp >> 16;
+   payload[3]  = rec->timestamp >> 24;
+   payload[4]  = rec->field;
+   payload[5]  = rec->field >> 8;
+   payload[6]  = rec->type;
+   payload[7]  = rec->arg;
+   payload[8]  = rec->value;
+   payload[9]  = rec->value >> 8;
+   payload[10] = rec->value >> 16;
+   payload[11] = rec->value >> 24;
+   tail = (tail + 1) & (TELEMETRY_RING_SIZE - 1);
+   buffer[len++] = FRAME_FLAG;
+   for (i = 0; i < sizeof(payload); i++) {
+      checksum ^= payload[i];
+      len = put_byte(buffer, len, payload[i]);
+   }
+   len = put_byte(buffer, len, checksum);
+   buffer[len++] = FRAME_FLAG;
+   return len;
+}
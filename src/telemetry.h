@@ -0,0 +1,67 @@
+// telemetry.h
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdint.h>
+
+// Binary event tracing
+//
+// Events are fixed size records, queued in a RAM ring and sent over the
+// UART (interleaved with the log messages) during the blanking period.
+//
+// Each record is sent as an HDLC-style frame:
+//   0x7E <escaped payload> 0x7E
+// where the payload is the 12-byte record (little endian) followed by an
+// XOR checksum, and 0x7E/0x7D in the payload are sent as 0x7D, (byte ^ 0x20).
+//
+// tools/telemetry_decode.py converts a captured stream to CSV or Chrome trace JSON.
+//
+// Note: keep the event types in sync with tools/telemetry_decode.py
+
+typedef enum {
+   TM_FIELD,        // arg = field flags,         value = vsync line
+   TM_GENLOCK,      // arg = genlock state,       value = line difference
+   TM_RESYNC,       // arg = unused,              value = resync count
+   TM_FLIP,         // arg = buffer,              value = unused
+   TM_KEY,          // arg = key,                 value = unused
+   TM_MODE,         // arg = mode7,               value = unused
+   TM_CAL_METRIC,   // arg = sample point value,  value = metric
+   TM_CAL_RESULT,   // arg = sample point value,  value = metric
+   TM_CLOCK,        // arg = 1 if drift,          value = clock error (ppm)
+   TM_DROPPED,      // arg = unused,              value = number of records dropped
+   TM_LATENCY,      // arg = 1 if drawn in place, value = capture to display latency (us)
+   TM_SLACK,        // arg = 0 line, 1 blanking,  value = slack (line in ns, blanking in us)
+   TM_TELETEXT,     // arg = line parity,         value = number of Mode 7 cells changed
+   NUM_TM_EVENTS
+} telemetry_event_t;
+
+// Field flags in TM_FIELD
+#define TM_FIELD_EVEN    0x01
+#define TM_FIELD_MODE7   0x02
+#define TM_FIELD_STATIC  0x04
+
+typedef struct {
+   uint32_t timestamp; // system timer, in microseconds
+   uint16_t field;     // field counter
+   uint8_t  type;      // telemetry_event_t
+   uint8_t  arg;
+   int32_t  value;
+} telemetry_record_t;
+
+#define TELEMETRY_DEFAULT_BAUD 921600
+
+// Start recording events; if baud is non-zero, the UART speed is changed
+extern void telemetry_enable(int baud);
+
+extern int telemetry_enabled();
+
+extern void telemetry_event(int type, int arg, int value);
+
+// Called once per field from rgb_to_fb, with the flags register
+extern void telemetry_field(int flags);
+
+// Encode the oldest record as a frame, returning its length (0 if none)
+extern int telemetry_frame(char *buffer, int size);
+
+#endif
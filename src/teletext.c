@@ -0,0 +1,211 @@
+#include <inttypes.h>
+#include <string.h>
+#include "defs.h"
+#include "logging.h"
+#include "saa5050_font.h"
+#include "telemetry.h"
+#include "teletext.h"
+
+#define NUM_CHARS        256
+#define FONT_STRIDE      32    // rows per character in fontdata
+
+#define GLYPH_TABLE_SIZE 512   // Must be a power of 2, and more than the number of distinct glyphs
+
+#define FNV_BASIS        0x811C9DC5
+#define FNV_PRIME        0x01000193
+
+// Pixel mask, ignoring the OSD bit (bit 3 of each pixel)
+#define PIXEL_MASK       0x77777777
+
+// Bytes per cell on a frame buffer line (12 pixels at 4bpp)
+#define CELL_BYTES       (TT_CELL_WIDTH / 2)
+
+// =============================================================
+// Local variables
+// =============================================================
+
+static teletext_cell_t grid[TT_ROWS * TT_COLS];
+
+// Hash of the pixels of each cell, for each field (i.e. frame buffer line parity)
+static unsigned int cell_hash[2][TT_ROWS * TT_COLS];
+
+// Character code + 1 of each distinct glyph (0 = empty), indexed by glyph_hash()
+static unsigned short glyph_table[GLYPH_TABLE_SIZE];
+
+static capture_info_t *capinfo;
+
+static int enabled;
+static int changed;
+
+// =============================================================
+// Private methods
+// =============================================================
+
+static unsigned int glyph_hash(const unsigned short *rows) {
+   unsigned int h = FNV_BASIS;
+   for (int y = 0; y < TT_CELL_HEIGHT; y++) {
+      h = (h ^ rows[y]) * FNV_PRIME;
+   }
+   return h;
+}
+
+static int glyph_equal(const unsigned short *rows, int c) {
+   for (int y = 0; y < TT_CELL_HEIGHT; y++) {
+      if (rows[y] != fontdata[FONT_STRIDE * c + y]) {
+         return 0;
+      }
+   }
+   return 1;
+}
+
+// Returns the character code of a glyph, or -1 if it is not in the font
+static int glyph_lookup(const unsigned short *rows) {
+   unsigned int i = glyph_hash(rows);
+   int code;
+   while ((code = glyph_table[i & (GLYPH_TABLE_SIZE - 1)]) != 0) {
+      if (glyph_equal(rows, code - 1)) {
+         return code - 1;
+      }
+      i++;
+   }
+   return -1;
+}
+
+static void build_glyph_table() {
+   unsigned short rows[TT_CELL_HEIGHT];
+   int distinct = 0;
+   memset(glyph_table, 0, sizeof(glyph_table));
+   // Start at the space, so blank cells decode as 0x20 rather than as a control code
+   for (int i = 0; i < NUM_CHARS; i++) {
+      int c = (i + 0x20) & (NUM_CHARS - 1);
+      for (int y = 0; y < TT_CELL_HEIGHT; y++) {
+         rows[y] = fontdata[FONT_STRIDE * c + y];
+      }
+      // Graphics characters that duplicate alphanumerics keep the lower code
+      if (glyph_lookup(rows) < 0) {
+         unsigned int j = glyph_hash(rows);
+         while (glyph_table[j & (GLYPH_TABLE_SIZE - 1)]) {
+            j++;
+         }
+         glyph_table[j & (GLYPH_TABLE_SIZE - 1)] = c + 1;
+         distinct++;
+      }
+   }
+   log_debug("Teletext: %d distinct glyphs", distinct);
+}
+
+// Convert a cell to one bit per pixel, with the top left pixel as the
+// background (this is always background in the SAA5050 font), then look it up
+static void decode_cell(unsigned char *fb, int pitch, teletext_cell_t *cell) {
+   unsigned short rows[TT_CELL_HEIGHT];
+   int bg = (fb[0] >> 4) & 7;
+   int fg = bg;
+   for (int y = 0; y < TT_CELL_HEIGHT; y++) {
+      int bits = 0;
+      for (int x = 0; x < TT_CELL_WIDTH; x++) {
+         // Pixel 2n is the high nibble of byte n
+         int c = (fb[x >> 1] >> ((x & 1) ? 0 : 4)) & 7;
+         if (c != bg) {
+            bits |= 1 << (TT_CELL_WIDTH - 1 - x);
+            fg = c;
+         }
+      }
+      rows[y] = bits;
+      fb += pitch;
+   }
+   int code = glyph_lookup(rows);
+   if (code >= 0) {
+      cell->code = code;
+      cell->attr = fg | (bg << 4);
+      cell->flags |= TT_DECODED;
+   } else {
+      cell->flags &= ~TT_DECODED;
+   }
+}
+
+// =============================================================
+// Public methods
+// =============================================================
+
+void teletext_enable(int on) {
+   if (on && !enabled) {
+      build_glyph_table();
+   }
+   enabled = on;
+}
+
+int teletext_enabled() {
+   return enabled;
+}
+
+void teletext_reset(capture_info_t *info) {
+   capinfo = info;
+   memset(grid, 0, sizeof(grid));
+   memset(cell_hash, 0, sizeof(cell_hash));
+   changed = 0;
+}
+
+void teletext_field(unsigned char *fb, int flags) {
+   if (!enabled || !capinfo || capinfo->bpp != 4) {
+      return;
+   }
+   int pitch = capinfo->pitch;
+   // The odd field is drawn one line below the even field
+   int parity = (flags & BIT_FIELD_TYPE) ? 0 : 1;
+
+   // The first captured line has a scan line count modulo 10 of (v_offset + 1)
+   int first_line = (10 - (capinfo->v_offset + 1) % 10) % 10;
+   int nrows = (capinfo->nlines - first_line) / 10;
+   int ncols = capinfo->width / TT_CELL_WIDTH;
+   int first_col = 0;
+   if (nrows > TT_ROWS) {
+      nrows = TT_ROWS;
+   }
+   if (ncols > TT_COLS) {
+      first_col = (ncols - TT_COLS) / 2;
+      ncols = TT_COLS;
+   }
+
+   changed = 0;
+   for (int row = 0; row < nrows; row++) {
+      unsigned int hash[TT_COLS];
+      unsigned char *top = fb + 2 * (first_line + row * 10) * pitch + first_col * CELL_BYTES;
+      unsigned char *line = top + parity * pitch;
+      for (int col = 0; col < ncols; col++) {
+         hash[col] = FNV_BASIS;
+      }
+      // Read this field's lines in order, accumulating the hash of every cell on the row
+      for (int y = 0; y < TT_CELL_HEIGHT; y += 2) {
+         uint16_t *p = (uint16_t *) line;
+         for (int col = 0; col < ncols; col++) {
+            unsigned int h = hash[col];
+            h = (h ^ ((p[0] | ((unsigned int) p[1] << 16)) & PIXEL_MASK)) * FNV_PRIME;
+            h = (h ^ (p[2] & PIXEL_MASK)) * FNV_PRIME;
+            hash[col] = h;
+            p += 3;
+         }
+         line += 2 * pitch;
+      }
+      teletext_cell_t *cell = grid + row * TT_COLS;
+      unsigned int *old = cell_hash[parity] + row * TT_COLS;
+      for (int col = 0; col < ncols; col++, cell++, old++) {
+         if (hash[col] != *old) {
+            *old = hash[col];
+            cell->flags |= TT_CHANGED;
+            decode_cell(top + col * CELL_BYTES, pitch, cell);
+            changed++;
+         } else {
+            cell->flags &= ~TT_CHANGED;
+         }
+      }
+   }
+   telemetry_event(TM_TELETEXT, parity, changed);
+}
+
+const teletext_cell_t *teletext_get_grid() {
+   return grid;
+}
+
+int teletext_changed() {
+   return changed;
+}
@@ -0,0 +1,55 @@
+// teletext.h
+
+#ifndef TELETEXT_H
+#define TELETEXT_H
+
+#include "defs.h"
+
+// Mode 7 character cell decoder
+//
+// Each field, the captured Mode 7 frame buffer is divided into a grid of
+// 12x20 pixel character cells, and each cell is compared with the same
+// field of the previous frame, so later stages can skip the cells that
+// have not changed (a Mode 7 screen is mostly static).
+//
+// Cells that change are then matched against the SAA5050 font to recover
+// the character code and the foreground/background colours. A cell that
+// does not match (e.g. double height, or a partial update) is still
+// tracked for changes, but is left without TT_DECODED.
+//
+// The grid is aligned vertically using the same scan line count modulo 10
+// as the deinterlace, and is centred horizontally in the captured width.
+
+#define TT_COLS 40
+#define TT_ROWS 25
+
+#define TT_CELL_WIDTH  12   // pixels
+#define TT_CELL_HEIGHT 20   // frame buffer lines (10 from each field)
+
+// Cell flags
+#define TT_CHANGED 0x01     // the cell changed in the last field
+#define TT_DECODED 0x02     // code and attr are valid
+
+typedef struct {
+   unsigned char code;      // character code, an index into the SAA5050 font
+   unsigned char attr;      // foreground colour | background colour << 4
+   unsigned char flags;
+} teletext_cell_t;
+
+extern void teletext_enable(int on);
+
+extern int teletext_enabled();
+
+// Forget the grid, e.g. after a mode change
+extern void teletext_reset(capture_info_t *capinfo);
+
+// Called once per field from rgb_to_fb in Mode 7, with the draw buffer and the flags register
+extern void teletext_field(unsigned char *fb, int flags);
+
+// The cell grid, TT_ROWS rows of TT_COLS cells
+extern const teletext_cell_t *teletext_get_grid();
+
+// The number of cells that changed in the last field
+extern int teletext_changed();
+
+#endif
@@ -0,0 +1,97 @@
+#!/usr/bin/env python3
+#
+# Generate the Mode 7 rounding lookup table from the SAA5050 font
+#
+# The advanced Mode 7 deinterlacer must not deinterlace the two lines of a
+# character that differ only because of the SAA5050 character rounding.
+# This script finds every such pair of lines in the font and writes them out
+# as an assembler include for capture_line_mode7_4bpp.S:
+#
+#     saa5050_font.c -> rounding_lookup.inc
+#
+# Usage:
+#
+#     gen_rounding_lookup.py saa5050_font.c rounding_lookup.inc
+#
+# The table is in a compact indexed form, to keep its cache footprint small:
+#
+# - rounding_index: 257 bytes, indexed by the first line of the pair, giving
+#   the range of entries in rounding_pairs that start with that line, i.e.
+#   rounding_index[a] to rounding_index[a + 1] - 1
+#
+# - rounding_pairs: a halfword per pair, (line pair << 8) | second line,
+#   sorted so the capture kernel can stop scanning once it has gone past
+#   the value it is looking for
+#
+# Each line is the 1 bit per pixel representation used by the capture
+# kernel: bit 0 is the leftmost of the 8 pixels it samples in the 12 pixel
+# wide character cell.
+#
+# An alternate character ROM can be supported by replacing saa5050_font.c.
+
+import re
+import sys
+
+NUM_CHARS = 256
+ROWS_PER_CHAR = 32
+LINE_PAIRS = 9   # the kernel never compares the first line pair
+FIRST_ROW = 2    # font rows of the first line pair compared by the kernel
+
+
+def read_font(filename):
+    with open(filename) as f:
+        data = [int(x, 16) for x in re.findall(r'0x([0-9a-fA-F]{4})', f.read())]
+    if len(data) != NUM_CHARS * ROWS_PER_CHAR:
+        sys.exit('%s: expected %d font words, found %d' % (filename, NUM_CHARS * ROWS_PER_CHAR, len(data)))
+    return data
+
+
+def sampled(row):
+    # The kernel samples pixels 3 to 10 of the cell, which are font bits 8 down to 1
+    return sum(((row >> (8 - i)) & 1) << i for i in range(8))
+
+
+def rounding_pairs(font):
+    pairs = set()
+    for c in range(NUM_CHARS):
+        for lp in range(LINE_PAIRS):
+            base = c * ROWS_PER_CHAR + FIRST_ROW + 2 * lp
+            a = sampled(font[base])
+            b = sampled(font[base + 1])
+            if a != b:
+                pairs.add((a, (lp << 8) | b))
+    return pairs
+
+
+def write_table(filename, font_filename, pairs):
+    index = []
+    entries = []
+    for a in range(256):
+        index.append(len(entries))
+        entries += sorted(key for first, key in pairs if first == a)
+    index.append(len(entries))
+    if len(entries) > 255:
+        sys.exit('too many rounding pairs (%d) for a byte index' % len(entries))
+
+    with open(filename, 'w') as f:
+        f.write('// Generated by gen_rounding_lookup.py from %s, do not edit\n' % font_filename)
+        f.write('// %d rounding pairs\n\n' % len(entries))
+        f.write('        .align 2\n')
+        f.write('rounding_pairs:\n')
+        for key in entries:
+            f.write('        .hword 0x%04x\n' % key)
+        f.write('\nrounding_index:\n')
+        for i in index:
+            f.write('        .byte %d\n' % i)
+        f.write('\n        .align 2\n')
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.exit('usage: %s <font.c> <output.inc>' % sys.argv[0])
+    font = read_font(sys.argv[1])
+    write_table(sys.argv[2], sys.argv[1].split('/')[-1], rounding_pairs(font))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,286 @@
+// genlock_sim.c
+//
+// Host-side simulation of the genlock loop, driving the real genlock.c
+//
+// Build and run (from the src/tools directory):
+//
+//     gcc -O2 -I.. -o genlock_sim genlock_sim.c ../genlock.c -lm
+//     ./genlock_sim [options] [vlockline ...]
+//
+// Options:
+//     -n fields   number of source fields to simulate (default 30000, i.e. 10 minutes)
+//     -p ppm      source field rate error, relative to 50Hz (default 300)
+//     -m ppm      error in the measured vsync_time_ns (default 50)
+//     -j ns       RMS jitter of each source field period (default 200)
+//     -d ppm      total drift of the source field rate over the run (default 20)
+//     -i          interlaced source (alternate 312/313 line fields)
+//     -a          enable vlockadj (rebuild the HDMI vertical timing to match the source)
+//     -6          use 720x480@60 HDMI timing, rather than 720x576@50
+//     -s seed     random seed (default 1)
+//     -v          print the vsync line error every field of the first run
+//
+// The model:
+// - The source produces fields of 312 (or 312/313) lines at 50Hz plus the
+//   above errors. rgb_to_fb captures nlines of these, counting r5 down from
+//   nlines to 1, and records r5 in vsync_line when the HDMI vsync occurs.
+// - The HDMI pipeline is 720x576@50 or 720x480@60, with the totals taken
+//   from the simulated PIXELVALVE2 registers, and a pixel clock of 19.2MHz x (NDIV + FRAC/2^20) / 10 / PIX, taken from the
+//   simulated PLLH registers that genlock.c programs, so the fractional
+//   divider quantisation is modelled exactly.
+// - At the end of each field genlock_update() is called, as rgb_to_fb does.
+//   A lock failure is handled as rgb_to_hdmi does, by recalibrating (which
+//   here just resets the genlock state).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include "defs.h"
+#include "genlock.h"
+#include "osd.h"
+
+// Source capture geometry, as for a typical 0..6 mode
+#define CAPTURE_START  24    // first captured line of each field
+#define CAPTURE_NLINES 270   // capinfo->nlines
+#define CAPTURE_HEIGHT 540   // capinfo->height
+
+// HDMI timings, both with a 27MHz pixel clock
+typedef struct {
+   const char *name;
+   int h_active, h_fp, h_sync, h_bp;
+   int v_active, v_fp, v_sync, v_bp;
+} hdmi_timing_t;
+
+static const hdmi_timing_t hdmi_576p50 = { "720x576@50", 720, 12, 64, 68, 576, 5, 5, 39 };
+static const hdmi_timing_t hdmi_480p60 = { "720x480@60", 720, 16, 62, 60, 480, 9, 6, 30 };
+
+// Simulated registers
+static uint32_t cprman[0x1800 / 4];
+static uint32_t pixelvalve[8];
+static uint32_t hdmi[0x100 / 4];
+
+static int verbose = 0;
+static int resyncs_logged = 0;
+
+// =============================================================
+// Stubs for the firmware's logging and telemetry
+// =============================================================
+
+static void vlog(const char *prefix, const char *fmt, va_list ap) {
+   if (verbose) {
+      printf("%s", prefix);
+      vprintf(fmt, ap);
+      printf("\n");
+   }
+}
+
+void log_info(const char *fmt, ...) {
+   va_list ap;
+   va_start(ap, fmt);
+   if (strncmp(fmt, "ReSync", 6) == 0) {
+      resyncs_logged++;
+   }
+   vlog("INFO: ", fmt, ap);
+   va_end(ap);
+}
+
+void log_warn(const char *fmt, ...) {
+   va_list ap;
+   va_start(ap, fmt);
+   vlog("WARN: ", fmt, ap);
+   va_end(ap);
+}
+
+void log_error(const char *fmt, ...) {
+   va_list ap;
+   va_start(ap, fmt);
+   vlog("ERROR: ", fmt, ap);
+   va_end(ap);
+}
+
+void telemetry_event(int type, int arg, int value) {
+}
+
+// =============================================================
+// Model
+// =============================================================
+
+static double gaussian() {
+   double u1 = (rand() + 1.0) / (RAND_MAX + 2.0);
+   double u2 = (rand() + 1.0) / (RAND_MAX + 2.0);
+   return sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+}
+
+static void init_registers(const hdmi_timing_t *t) {
+   memset(cprman, 0, sizeof(cprman));
+   memset(pixelvalve, 0, sizeof(pixelvalve));
+   memset(hdmi, 0, sizeof(hdmi));
+   // 720x576@50    PLLH: PDIV=1 NDIV=56 FRAC=262144 AUX=256 RCAL=256 PIX=4 STS=526655
+   cprman[PLLH_CTRL] = (1 << 12) | 56;
+   cprman[PLLH_FRAC] = 262144;
+   cprman[PLLH_AUX]  = 256;
+   cprman[PLLH_RCAL] = 256;
+   cprman[PLLH_PIX]  = 4;
+   cprman[PLLH_STS]  = 526655;
+   pixelvalve[3] = (t->h_bp << 16) | t->h_sync;
+   pixelvalve[4] = (t->h_fp << 16) | t->h_active;
+   pixelvalve[5] = (t->v_bp << 16) | t->v_sync;
+   pixelvalve[6] = (t->v_fp << 16) | t->v_active;
+   // HDMI_VERTA0/1 - VSP[24:20], VFP[19:13], VAL[12:0]
+   hdmi[0xcc / 4] = (t->v_sync << 20) | (t->v_fp << 13) | t->v_active;
+   hdmi[0xd4 / 4] = hdmi[0xcc / 4];
+   genlock_set_registers(cprman, pixelvalve, hdmi);
+   genlock_reset();
+}
+
+// The HDMI frame period in ns, from the current register values
+static double hdmi_period_ns() {
+   double ndiv = (double) (cprman[PLLH_CTRL] & 0x3ff) + (double) (cprman[PLLH_FRAC] & 0xfffff) / (double) (1 << 20);
+   double pixel_clock = 19.2e6 * ndiv / 10.0 / (double) (cprman[PLLH_PIX] & 0xff);
+   uint32_t htotal = pixelvalve[3] + pixelvalve[4];
+   uint32_t vtotal = pixelvalve[5] + pixelvalve[6];
+   htotal = (htotal + (htotal >> 16)) & 0xFFFF;
+   vtotal = (vtotal + (vtotal >> 16)) & 0xFFFF;
+   // The HDMI core must always agree with the PIXELVALVE
+   if (((hdmi[0xcc / 4] >> 13) & 0x7f) != (pixelvalve[6] >> 16)) {
+      printf("HDMI_VERTA0 and PIXELVALVE2_VERTB front porch mismatch\n");
+      exit(1);
+   }
+   return 1e9 * (double) htotal * (double) vtotal / pixel_clock;
+}
+
+typedef struct {
+   int nfields;
+   double source_ppm;
+   double measure_ppm;
+   double jitter_ns;
+   double drift_ppm;
+   int interlaced;
+   int vlockadj;
+   const hdmi_timing_t *hdmi;
+} sim_params_t;
+
+typedef struct {
+   int lock_field;      // first field at which lock was declared, or -1
+   double rms_error;    // RMS vsync line error after lock
+   int max_error;       // max abs vsync line error after lock
+   int resyncs;
+   int lock_failures;
+   int unlocked_fields; // fields after first lock that were not locked
+} sim_result_t;
+
+static void simulate(const sim_params_t *p, int vlockline, int trace, sim_result_t *r) {
+   double base_period = 20e6 / (1.0 + p->source_ppm * 1e-6);
+   int measured_ns = (int) (2.0 * base_period * (1.0 + p->measure_ppm * 1e-6));
+   int default_vsync_line = (vlockline > CAPTURE_HEIGHT / 4) ? 1 : CAPTURE_HEIGHT / 2;
+   double t = 0;
+   double next_vsync;
+   double sum_sq = 0;
+   int nlocked = 0;
+   int field;
+
+   memset(r, 0, sizeof(*r));
+   r->lock_field = -1;
+   resyncs_logged = 0;
+
+   init_registers(p->hdmi);
+   genlock_set_mode_match(p->vlockadj);
+
+   // Start with a random phase between the source and the HDMI display
+   next_vsync = hdmi_period_ns() * (rand() / (RAND_MAX + 1.0));
+
+   for (field = 0; field < p->nfields; field++) {
+      int lines = p->interlaced ? 312 + (field & 1) : 312;
+      double drift = p->drift_ppm * 1e-6 * field / p->nfields;
+      double period = base_period * (1.0 - drift) + p->jitter_ns * gaussian();
+      double line_time = period / lines;
+      int vsync_line = default_vsync_line;
+
+      // Any HDMI vsyncs during this field
+      while (next_vsync < t + period) {
+         int line = (int) ((next_vsync - t) / line_time) - CAPTURE_START;
+         if (line >= 0 && line < CAPTURE_NLINES) {
+            vsync_line = CAPTURE_NLINES - line;
+         }
+         next_vsync += hdmi_period_ns();
+      }
+      t += period;
+
+      // End of field processing
+      genlock_update(HDMI_EXACT, vlockline, vsync_line, CAPTURE_HEIGHT, measured_ns);
+      if (genlock_lock_failed()) {
+         r->lock_failures++;
+         genlock_reset();
+         genlock_invalidate();
+      }
+      if (trace) {
+         printf("%6d %4d %d\n", field, vsync_line - vlockline, genlock_is_locked());
+      }
+      if (genlock_is_locked() && r->lock_field < 0) {
+         r->lock_field = field;
+      }
+      if (r->lock_field >= 0) {
+         int error = vsync_line - vlockline;
+         if (genlock_is_locked()) {
+            sum_sq += (double) error * error;
+            if (abs(error) > r->max_error) {
+               r->max_error = abs(error);
+            }
+            nlocked++;
+         } else {
+            r->unlocked_fields++;
+         }
+      }
+   }
+   r->rms_error = nlocked ? sqrt(sum_sq / nlocked) : 0;
+   r->resyncs = resyncs_logged;
+}
+
+int main(int argc, char **argv) {
+   static const int default_vlocklines[] = { 5, 20, 50, 100, 150, 200, 265 };
+   sim_params_t p = { 30000, 300.0, 50.0, 200.0, 20.0, 0, 0, &hdmi_576p50 };
+   unsigned int seed = 1;
+   int opt;
+   int i;
+
+   while ((opt = getopt(argc, argv, "n:p:m:j:d:ias:6v")) != -1) {
+      switch (opt) {
+      case 'n': p.nfields     = atoi(optarg); break;
+      case 'p': p.source_ppm  = atof(optarg); break;
+      case 'm': p.measure_ppm = atof(optarg); break;
+      case 'j': p.jitter_ns   = atof(optarg); break;
+      case 'd': p.drift_ppm   = atof(optarg); break;
+      case 'i': p.interlaced  = 1;            break;
+      case 'a': p.vlockadj    = 1;            break;
+      case '6': p.hdmi = &hdmi_480p60;        break;
+      case 's': seed = atoi(optarg);          break;
+      case 'v': verbose = 1;                  break;
+      default:
+         fprintf(stderr, "usage: %s [-n fields] [-p ppm] [-m ppm] [-j ns] [-d ppm] [-i] [-a] [-6] [-s seed] [-v] [vlockline ...]\n", argv[0]);
+         return 1;
+      }
+   }
+   srand(seed);
+
+   printf("fields=%d source=%+.0fppm measure=%+.0fppm jitter=%.0fns drift=%+.0fppm %s hdmi=%s vlockadj=%d\n",
+          p.nfields, p.source_ppm, p.measure_ppm, p.jitter_ns, p.drift_ppm,
+          p.interlaced ? "interlaced" : "progressive", p.hdmi->name, p.vlockadj);
+   printf("vlockline  lock time(s)  rms err(lines)  max err(lines)  unlocked fields  resyncs  lock fails\n");
+
+   int n = (optind < argc) ? argc - optind : sizeof(default_vlocklines) / sizeof(int);
+   for (i = 0; i < n; i++) {
+      int vlockline = (optind < argc) ? atoi(argv[optind + i]) : default_vlocklines[i];
+      sim_result_t r;
+      simulate(&p, vlockline, verbose && i == 0, &r);
+      if (r.lock_field < 0) {
+         printf("%9d  %12s  %14s  %14s  %15s  %7d  %10d\n", vlockline, "never", "-", "-", "-", r.resyncs, r.lock_failures);
+      } else {
+         printf("%9d  %12.2f  %14.3f  %14d  %15d  %7d  %10d\n", vlockline, r.lock_field * 0.02,
+                r.rms_error, r.max_error, r.unlocked_fields, r.resyncs, r.lock_failures);
+      }
+   }
+   return 0;
+}
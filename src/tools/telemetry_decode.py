@@ -0,0 +1,147 @@
+#!/usr/bin/env python3
+#
+# Decode the RGBtoHDMI binary telemetry stream
+#
+# The stream is enabled with telemetry=1 in cmdline.txt, and is interleaved
+# with the normal log messages on the UART. Capture it to a file with
+# something like:
+#
+#     stty -F /dev/ttyUSB0 921600 raw && cat /dev/ttyUSB0 > capture.bin
+#
+# then convert it with:
+#
+#     telemetry_decode.py capture.bin --format csv   > capture.csv
+#     telemetry_decode.py capture.bin --format trace > capture.json
+#
+# The trace output can be loaded into chrome://tracing (or Perfetto).
+#
+# See telemetry.h for a description of the framing.
+
+import argparse
+import json
+import struct
+import sys
+
+FRAME_FLAG = 0x7E
+FRAME_ESCAPE = 0x7D
+RECORD = struct.Struct('<IHBBi')
+
+# Keep in sync with telemetry_event_t in telemetry.h
+EVENTS = [
+    'field',
+    'genlock',
+    'resync',
+    'flip',
+    'key',
+    'mode',
+    'cal_metric',
+    'cal_result',
+    'clock',
+    'dropped',
+    'latency',
+    'slack',
+    'teletext',
+]
+
+# Events that are plotted as counters (the value), rather than instants
+COUNTERS = {
+    'field': 'vsync_line',
+    'genlock': 'difference',
+    'clock': 'ppm',
+    'latency': 'us',
+    'teletext': 'cells',
+}
+
+
+def frames(data):
+    """Yield the unescaped contents of each 0x7E delimited frame"""
+    frame = None
+    escape = False
+    for c in data:
+        if c == FRAME_FLAG:
+            if frame:
+                yield bytes(frame)
+            frame = bytearray()
+            escape = False
+        elif frame is None:
+            continue
+        elif c == FRAME_ESCAPE:
+            escape = True
+        else:
+            frame.append(c ^ 0x20 if escape else c)
+            escape = False
+
+
+def records(data):
+    """Yield (timestamp_us, field, event, arg, value) for each valid record"""
+    wrap = 0
+    last = None
+    for frame in frames(data):
+        # Anything else between flags is log text (or noise), so discard it
+        if len(frame) != RECORD.size + 1:
+            continue
+        checksum = 0
+        for c in frame[:-1]:
+            checksum ^= c
+        if checksum != frame[-1]:
+            continue
+        timestamp, field, event, arg, value = RECORD.unpack(frame[:-1])
+        # The system timer is 32 bits, so it wraps every ~71 minutes
+        if last is not None and timestamp < last:
+            wrap += 1 << 32
+        last = timestamp
+        if event < len(EVENTS):
+            name = EVENTS[event]
+        else:
+            name = 'event%d' % event
+        yield timestamp + wrap, field, name, arg, value
+
+
+def write_csv(recs, out):
+    out.write('timestamp_us,field,event,arg,value\n')
+    for timestamp, field, name, arg, value in recs:
+        out.write('%d,%d,%s,%d,%d\n' % (timestamp, field, name, arg, value))
+
+
+def write_trace(recs, out):
+    events = []
+    in_field = False
+    for timestamp, field, name, arg, value in recs:
+        if name in COUNTERS:
+            events.append({'name': name, 'ph': 'C', 'ts': timestamp, 'pid': 1,
+                           'args': {COUNTERS[name]: value}})
+        if name == 'field':
+            # Show each field as a slice, so the per-field timeline is visible
+            if in_field:
+                events.append({'ph': 'E', 'ts': timestamp, 'pid': 1, 'tid': 1})
+            events.append({'name': 'field %d' % field, 'ph': 'B', 'ts': timestamp,
+                           'pid': 1, 'tid': 1, 'args': {'flags': arg}})
+            in_field = True
+        elif name not in COUNTERS:
+            events.append({'name': name, 'ph': 'i', 's': 't', 'ts': timestamp,
+                           'pid': 1, 'tid': 2,
+                           'args': {'field': field, 'arg': arg, 'value': value}})
+    json.dump({'traceEvents': events, 'displayTimeUnit': 'ms'}, out, indent=0)
+    out.write('\n')
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Decode an RGBtoHDMI telemetry capture')
+    parser.add_argument('input', help='captured UART output (- for stdin)')
+    parser.add_argument('--format', choices=['csv', 'trace'], default='csv',
+                        help='output format (default: csv)')
+    args = parser.parse_args()
+    if args.input == '-':
+        data = sys.stdin.buffer.read()
+    else:
+        with open(args.input, 'rb') as f:
+            data = f.read()
+    recs = records(data)
+    if args.format == 'csv':
+        write_csv(recs, sys.stdout)
+    else:
+        write_trace(recs, sys.stdout)
+
+
+if __name__ == '__main__':
+    main()